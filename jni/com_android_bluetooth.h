@@ -27,10 +27,20 @@
 #include "nativehelper/ScopedLocalRef.h"
 #include "utils/Log.h"
 
+// Set to 1 to also compare the callback env against the runtime's JNIEnv
+// for the current thread on every callback. This is a debugging aid; the
+// default check only looks at a thread-local flag.
+#ifndef BT_JNI_STRICT_CALLBACK_ENV
+#define BT_JNI_STRICT_CALLBACK_ENV 0
+#endif
+
 namespace android {
 
 JNIEnv* getCallbackEnv();
 
+// True on the stack's callback thread while it is attached to the JVM.
+bool isCallbackThread();
+
 class CallbackEnv {
 public:
     CallbackEnv(const char *methodName) : mName(methodName) {
@@ -46,11 +56,19 @@ public:
     }
 
     bool valid() const {
+#if BT_JNI_STRICT_CALLBACK_ENV
       JNIEnv *env = AndroidRuntime::getJNIEnv();
       if (!mCallbackEnv || (mCallbackEnv != env)) {
           ALOGE("%s: Callback env fail: env: %p, callback: %p", mName, env, mCallbackEnv);
           return false;
       }
+#else
+      if (!mCallbackEnv || !isCallbackThread()) {
+          ALOGE("%s: Callback env fail: not on callback thread, callback: %p", mName,
+                mCallbackEnv);
+          return false;
+      }
+#endif
       return true;
     }
 
@@ -130,6 +148,25 @@ private:
 
 const bt_interface_t* getBluetoothInterface();
 
+// A Java method called from native code, resolved by bindJniMethods().
+struct JniMethod {
+  jmethodID* id;
+  const char* name;
+  const char* signature;
+};
+
+/* Resolves all |methods| of |clazz| in one pass, logging the time taken
+ * under |tag|. Returns false, with NoSuchMethodError pending, if any of them
+ * is missing; the rest are still resolved. */
+bool bindJniMethods(JNIEnv* env, jclass clazz, const JniMethod* methods,
+                    size_t count, const char* tag);
+
+template <size_t N>
+bool bindJniMethods(JNIEnv* env, jclass clazz, const JniMethod (&methods)[N],
+                    const char* tag) {
+  return bindJniMethods(env, clazz, methods, N, tag);
+}
+
 int register_com_android_bluetooth_hfp(JNIEnv* env);
 
 int register_com_android_bluetooth_hfpclient(JNIEnv* env);
@@ -152,6 +189,8 @@ int register_com_android_bluetooth_pan(JNIEnv* env);
 
 int register_com_android_bluetooth_gatt (JNIEnv* env);
 
+void dump_advertising_metrics(int fd);
+
 int register_com_android_bluetooth_sdp (JNIEnv* env);
 
 int register_com_android_bluetooth_hearing_aid(JNIEnv* env);
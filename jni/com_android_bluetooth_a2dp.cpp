@@ -168,6 +168,15 @@ static btav_source_callbacks_t sBluetoothA2dpCallbacks = {
     bta2dp_audio_state_callback, bta2dp_audio_config_callback,
 };
 
+static const JniMethod sJavaMethods[] = {
+    {&method_onConnectionStateChanged, "onConnectionStateChanged", "([BI)V"},
+    {&method_onAudioStateChanged, "onAudioStateChanged", "([BI)V"},
+    {&method_onCodecConfigChanged, "onCodecConfigChanged",
+     "([BLandroid/bluetooth/BluetoothCodecConfig;"
+     "[Landroid/bluetooth/BluetoothCodecConfig;"
+     "[Landroid/bluetooth/BluetoothCodecConfig;)V"},
+};
+
 static void classInitNative(JNIEnv* env, jclass clazz) {
   jclass jniBluetoothCodecConfigClass =
       env->FindClass("android/bluetooth/BluetoothCodecConfig");
@@ -192,17 +201,7 @@ static void classInitNative(JNIEnv* env, jclass clazz) {
   android_bluetooth_BluetoothCodecConfig.getCodecSpecific4 = env->GetMethodID(
       jniBluetoothCodecConfigClass, "getCodecSpecific4", "()J");
 
-  method_onConnectionStateChanged =
-      env->GetMethodID(clazz, "onConnectionStateChanged", "([BI)V");
-
-  method_onAudioStateChanged =
-      env->GetMethodID(clazz, "onAudioStateChanged", "([BI)V");
-
-  method_onCodecConfigChanged =
-      env->GetMethodID(clazz, "onCodecConfigChanged",
-                       "([BLandroid/bluetooth/BluetoothCodecConfig;"
-                       "[Landroid/bluetooth/BluetoothCodecConfig;"
-                       "[Landroid/bluetooth/BluetoothCodecConfig;)V");
+  if (!bindJniMethods(env, clazz, sJavaMethods, "a2dp")) return;
 
   ALOGI("%s: succeeds", __func__);
 }
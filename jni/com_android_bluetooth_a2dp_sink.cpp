@@ -97,15 +97,14 @@ static btav_sink_callbacks_t sBluetoothA2dpCallbacks = {
     bta2dp_audio_state_callback, bta2dp_audio_config_callback,
 };
 
-static void classInitNative(JNIEnv* env, jclass clazz) {
-  method_onConnectionStateChanged =
-      env->GetMethodID(clazz, "onConnectionStateChanged", "([BI)V");
-
-  method_onAudioStateChanged =
-      env->GetMethodID(clazz, "onAudioStateChanged", "([BI)V");
+static const JniMethod sJavaMethods[] = {
+    {&method_onConnectionStateChanged, "onConnectionStateChanged", "([BI)V"},
+    {&method_onAudioStateChanged, "onAudioStateChanged", "([BI)V"},
+    {&method_onAudioConfigChanged, "onAudioConfigChanged", "([BII)V"},
+};
 
-  method_onAudioConfigChanged =
-      env->GetMethodID(clazz, "onAudioConfigChanged", "([BII)V");
+static void classInitNative(JNIEnv* env, jclass clazz) {
+  if (!bindJniMethods(env, clazz, sJavaMethods, "a2dp_sink")) return;
 
   ALOGI("%s: succeeds", __func__);
 }
@@ -741,70 +741,46 @@ static btrc_ctrl_callbacks_t sBluetoothAvrcpCallbacks = {
     btavrcp_addressed_player_changed_callback,
     btavrcp_now_playing_content_changed_callback};
 
+static const JniMethod sJavaMethods[] = {
+    {&method_handlePassthroughRsp, "handlePassthroughRsp", "(II[B)V"},
+    {&method_handleGroupNavigationRsp, "handleGroupNavigationRsp", "(II)V"},
+    {&method_onConnectionStateChanged, "onConnectionStateChanged", "(ZZ[B)V"},
+    {&method_getRcFeatures, "getRcFeatures", "([BI)V"},
+    {&method_setplayerappsettingrsp, "setPlayerAppSettingRsp", "([BB)V"},
+    {&method_handleplayerappsetting, "handlePlayerAppSetting", "([B[BI)V"},
+    {&method_handleplayerappsettingchanged, "onPlayerAppSettingChanged",
+     "([B[BI)V"},
+    {&method_handleSetAbsVolume, "handleSetAbsVolume", "([BBB)V"},
+    {&method_handleRegisterNotificationAbsVol,
+     "handleRegisterNotificationAbsVol", "([BB)V"},
+    {&method_handletrackchanged, "onTrackChanged",
+     "([BB[I[Ljava/lang/String;)V"},
+    {&method_handleplaypositionchanged, "onPlayPositionChanged", "([BII)V"},
+    {&method_handleplaystatuschanged, "onPlayStatusChanged", "([BB)V"},
+    {&method_handleGetFolderItemsRsp, "handleGetFolderItemsRsp",
+     "([BI[Landroid/media/browse/MediaBrowser$MediaItem;)V"},
+    {&method_handleGetPlayerItemsRsp, "handleGetPlayerItemsRsp",
+     "([B[Lcom/android/bluetooth/avrcpcontroller/AvrcpPlayer;)V"},
+    {&method_createFromNativeMediaItem, "createFromNativeMediaItem",
+     "(JILjava/lang/String;[I[Ljava/lang/String;"
+     ")Landroid/media/browse/MediaBrowser$MediaItem;"},
+    {&method_createFromNativeFolderItem, "createFromNativeFolderItem",
+     "(JILjava/lang/String;I)Landroid/media/browse/MediaBrowser$MediaItem;"},
+    {&method_createFromNativePlayerItem, "createFromNativePlayerItem",
+     "(ILjava/lang/String;"
+     "[BII)Lcom/android/bluetooth/avrcpcontroller/AvrcpPlayer;"},
+    {&method_handleChangeFolderRsp, "handleChangeFolderRsp", "([BI)V"},
+    {&method_handleSetBrowsedPlayerRsp, "handleSetBrowsedPlayerRsp", "([BII)V"},
+    {&method_handleSetAddressedPlayerRsp, "handleSetAddressedPlayerRsp",
+     "([BI)V"},
+    {&method_handleAddressedPlayerChanged, "handleAddressedPlayerChanged",
+     "([BI)V"},
+    {&method_handleNowPlayingContentChanged, "handleNowPlayingContentChanged",
+     "([B)V"},
+};
+
 static void classInitNative(JNIEnv* env, jclass clazz) {
-  method_handlePassthroughRsp =
-      env->GetMethodID(clazz, "handlePassthroughRsp", "(II[B)V");
-
-  method_handleGroupNavigationRsp =
-      env->GetMethodID(clazz, "handleGroupNavigationRsp", "(II)V");
-
-  method_onConnectionStateChanged =
-      env->GetMethodID(clazz, "onConnectionStateChanged", "(ZZ[B)V");
-
-  method_getRcFeatures = env->GetMethodID(clazz, "getRcFeatures", "([BI)V");
-
-  method_setplayerappsettingrsp =
-      env->GetMethodID(clazz, "setPlayerAppSettingRsp", "([BB)V");
-
-  method_handleplayerappsetting =
-      env->GetMethodID(clazz, "handlePlayerAppSetting", "([B[BI)V");
-
-  method_handleplayerappsettingchanged =
-      env->GetMethodID(clazz, "onPlayerAppSettingChanged", "([B[BI)V");
-
-  method_handleSetAbsVolume =
-      env->GetMethodID(clazz, "handleSetAbsVolume", "([BBB)V");
-
-  method_handleRegisterNotificationAbsVol =
-      env->GetMethodID(clazz, "handleRegisterNotificationAbsVol", "([BB)V");
-
-  method_handletrackchanged =
-      env->GetMethodID(clazz, "onTrackChanged", "([BB[I[Ljava/lang/String;)V");
-
-  method_handleplaypositionchanged =
-      env->GetMethodID(clazz, "onPlayPositionChanged", "([BII)V");
-
-  method_handleplaystatuschanged =
-      env->GetMethodID(clazz, "onPlayStatusChanged", "([BB)V");
-
-  method_handleGetFolderItemsRsp =
-      env->GetMethodID(clazz, "handleGetFolderItemsRsp",
-                       "([BI[Landroid/media/browse/MediaBrowser$MediaItem;)V");
-  method_handleGetPlayerItemsRsp = env->GetMethodID(
-      clazz, "handleGetPlayerItemsRsp",
-      "([B[Lcom/android/bluetooth/avrcpcontroller/AvrcpPlayer;)V");
-
-  method_createFromNativeMediaItem =
-      env->GetMethodID(clazz, "createFromNativeMediaItem",
-                       "(JILjava/lang/String;[I[Ljava/lang/String;)Landroid/"
-                       "media/browse/MediaBrowser$MediaItem;");
-  method_createFromNativeFolderItem = env->GetMethodID(
-      clazz, "createFromNativeFolderItem",
-      "(JILjava/lang/String;I)Landroid/media/browse/MediaBrowser$MediaItem;");
-  method_createFromNativePlayerItem =
-      env->GetMethodID(clazz, "createFromNativePlayerItem",
-                       "(ILjava/lang/String;[BII)Lcom/android/bluetooth/"
-                       "avrcpcontroller/AvrcpPlayer;");
-  method_handleChangeFolderRsp =
-      env->GetMethodID(clazz, "handleChangeFolderRsp", "([BI)V");
-  method_handleSetBrowsedPlayerRsp =
-      env->GetMethodID(clazz, "handleSetBrowsedPlayerRsp", "([BII)V");
-  method_handleSetAddressedPlayerRsp =
-      env->GetMethodID(clazz, "handleSetAddressedPlayerRsp", "([BI)V");
-  method_handleAddressedPlayerChanged =
-      env->GetMethodID(clazz, "handleAddressedPlayerChanged", "([BI)V");
-  method_handleNowPlayingContentChanged =
-      env->GetMethodID(clazz, "handleNowPlayingContentChanged", "([B)V");
+  if (!bindJniMethods(env, clazz, sJavaMethods, "avrcp_controller")) return;
 
   ALOGI("%s: succeeds", __func__);
 }
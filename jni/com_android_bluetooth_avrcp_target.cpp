@@ -171,47 +171,32 @@ static jmethodID method_volumeDeviceDisconnected;
 
 static jmethodID method_setVolume;
 
-static void classInitNative(JNIEnv* env, jclass clazz) {
-  method_getCurrentSongInfo = env->GetMethodID(
-      clazz, "getCurrentSongInfo", "()Lcom/android/bluetooth/avrcp/Metadata;");
-
-  method_getPlaybackStatus = env->GetMethodID(
-      clazz, "getPlayStatus", "()Lcom/android/bluetooth/avrcp/PlayStatus;");
-
-  method_sendMediaKeyEvent =
-      env->GetMethodID(clazz, "sendMediaKeyEvent", "(IZ)V");
-
-  method_getCurrentMediaId =
-      env->GetMethodID(clazz, "getCurrentMediaId", "()Ljava/lang/String;");
-
-  method_getNowPlayingList =
-      env->GetMethodID(clazz, "getNowPlayingList", "()Ljava/util/List;");
-
-  method_getCurrentPlayerId =
-      env->GetMethodID(clazz, "getCurrentPlayerId", "()I");
-
-  method_getMediaPlayerList =
-      env->GetMethodID(clazz, "getMediaPlayerList", "()Ljava/util/List;");
-
-  method_setBrowsedPlayer = env->GetMethodID(clazz, "setBrowsedPlayer", "(I)V");
-
-  method_getFolderItemsRequest = env->GetMethodID(
-      clazz, "getFolderItemsRequest", "(ILjava/lang/String;)V");
-
-  method_playItem =
-      env->GetMethodID(clazz, "playItem", "(IZLjava/lang/String;)V");
-
-  method_setActiveDevice =
-      env->GetMethodID(clazz, "setActiveDevice", "(Ljava/lang/String;)V");
-
-  // Volume Management functions
-  method_volumeDeviceConnected =
-      env->GetMethodID(clazz, "deviceConnected", "(Ljava/lang/String;Z)V");
-
-  method_volumeDeviceDisconnected =
-      env->GetMethodID(clazz, "deviceDisconnected", "(Ljava/lang/String;)V");
+static const JniMethod sJavaMethods[] = {
+    {&method_getCurrentSongInfo, "getCurrentSongInfo",
+     "()Lcom/android/bluetooth/avrcp/Metadata;"},
+    {&method_getPlaybackStatus, "getPlayStatus",
+     "()Lcom/android/bluetooth/avrcp/PlayStatus;"},
+    {&method_sendMediaKeyEvent, "sendMediaKeyEvent", "(IZ)V"},
+    {&method_getCurrentMediaId, "getCurrentMediaId", "()Ljava/lang/String;"},
+    {&method_getNowPlayingList, "getNowPlayingList", "()Ljava/util/List;"},
+    {&method_getCurrentPlayerId, "getCurrentPlayerId", "()I"},
+    {&method_getMediaPlayerList, "getMediaPlayerList", "()Ljava/util/List;"},
+    {&method_setBrowsedPlayer, "setBrowsedPlayer", "(I)V"},
+    {&method_getFolderItemsRequest, "getFolderItemsRequest",
+     "(ILjava/lang/String;)V"},
+    {&method_playItem, "playItem", "(IZLjava/lang/String;)V"},
+    {&method_setActiveDevice, "setActiveDevice", "(Ljava/lang/String;)V"},
+
+    // Volume Management functions
+    {&method_volumeDeviceConnected, "deviceConnected",
+     "(Ljava/lang/String;Z)V"},
+    {&method_volumeDeviceDisconnected, "deviceDisconnected",
+     "(Ljava/lang/String;)V"},
+    {&method_setVolume, "setVolume", "(I)V"},
+};
 
-  method_setVolume = env->GetMethodID(clazz, "setVolume", "(I)V");
+static void classInitNative(JNIEnv* env, jclass clazz) {
+  if (!bindJniMethods(env, clazz, sJavaMethods, "avrcp_target")) return;
 
   ALOGI("%s: AvrcpTargetJni initialized!", __func__);
 }
@@ -19,6 +19,8 @@
 #include "android_runtime/Log.h"
 #include "bluetooth_socket_manager.h"
 #include "com_android_bluetooth.h"
+#include "com_android_bluetooth_dump.h"
+#include "com_android_bluetooth_remote_props.h"
 #include "hardware/bt_sock.h"
 #include "permission_helpers.h"
 #include "utils/Log.h"
@@ -31,14 +33,33 @@
 #include <dlfcn.h>
 #include <errno.h>
 #include <pthread.h>
+#include <stdio.h>
 #include <string.h>
 
 #include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
 #include <sys/prctl.h>
 #include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
 
 #include <hardware/bluetooth.h>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <list>
+#include <map>
 #include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
 
 using android::bluetooth::BluetoothSocketManagerBinderServer;
 
@@ -52,7 +73,7 @@ namespace android {
 static jmethodID method_stateChangeCallback;
 static jmethodID method_adapterPropertyChangedCallback;
 static jmethodID method_devicePropertyChangedCallback;
-static jmethodID method_deviceFoundCallback;
+static jmethodID method_deviceFoundWithPropertiesCallback;
 static jmethodID method_pinRequestCallback;
 static jmethodID method_sspRequestCallback;
 static jmethodID method_bondStateChangeCallback;
@@ -83,8 +104,66 @@ std::mutex sSocketManagerMutex;
 
 const bt_interface_t* getBluetoothInterface() { return sBluetoothInterface; }
 
+static thread_local bool sIsCallbackThread = false;
+
 JNIEnv* getCallbackEnv() { return callbackEnv; }
 
+bool isCallbackThread() { return sIsCallbackThread; }
+
+// Time spent in each bindJniMethods() call, for the dump.
+struct JniBindingTime {
+  std::string tag;
+  size_t count;
+  size_t missing;
+  std::chrono::microseconds time;
+};
+
+static std::mutex sJniBindingMutex;
+static std::vector<JniBindingTime> sJniBindingTimes;
+
+bool bindJniMethods(JNIEnv* env, jclass clazz, const JniMethod* methods,
+                    size_t count, const char* tag) {
+  auto start = std::chrono::steady_clock::now();
+  const char* first_missing = NULL;
+  size_t missing = 0;
+  for (size_t i = 0; i < count; i++) {
+    *methods[i].id =
+        env->GetMethodID(clazz, methods[i].name, methods[i].signature);
+    if (*methods[i].id != NULL) continue;
+
+    // Clear the error so that the remaining methods can still be resolved.
+    env->ExceptionClear();
+    ALOGE("%s: %s: no method %s%s", __func__, tag, methods[i].name,
+          methods[i].signature);
+    if (!missing++) first_missing = methods[i].name;
+  }
+  auto time = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - start);
+
+  ALOGI("%s: %s: %zu methods in %lld us", __func__, tag, count,
+        (long long)time.count());
+  {
+    std::lock_guard<std::mutex> lock(sJniBindingMutex);
+    sJniBindingTimes.push_back({tag, count, missing, time});
+  }
+
+  if (missing) {
+    jniThrowException(env, "java/lang/NoSuchMethodError", first_missing);
+    return false;
+  }
+  return true;
+}
+
+static void dump_jni_binding_times(int fd) {
+  std::lock_guard<std::mutex> lock(sJniBindingMutex);
+  dprintf(fd, "\nJNI method binding:\n");
+  for (const JniBindingTime& binding : sJniBindingTimes) {
+    dprintf(fd, "  %-24s %3zu methods %3zu missing %6lld us\n",
+            binding.tag.c_str(), binding.count, binding.missing,
+            (long long)binding.time.count());
+  }
+}
+
 static void adapter_state_change_callback(bt_state_t status) {
   CallbackEnv sCallbackEnv(__func__);
   if (!sCallbackEnv.valid()) return;
@@ -94,21 +173,44 @@ static void adapter_state_change_callback(bt_state_t status) {
                                (jint)status);
 }
 
-static int get_properties(int num_properties, bt_property_t* properties,
-                          jintArray* types, jobjectArray* props) {
+/* Properties cross into Java as one byte[] of records plus an int[] with the
+ * offset of each record. A record is the property type and value length, both
+ * 32-bit little endian, followed by the value. */
+static constexpr size_t kPackedPropertyHeaderLen = 8;
+
+static void put_le32(std::vector<uint8_t>* buf, uint32_t v) {
+  for (int i = 0; i < 4; i++) buf->push_back((v >> (8 * i)) & 0xFF);
+}
+
+static int pack_properties(JNIEnv* env, int num_properties,
+                           const bt_property_t* properties,
+                           ScopedLocalRef<jbyteArray>* packed,
+                           ScopedLocalRef<jintArray>* offsets) {
+  size_t total = 0;
   for (int i = 0; i < num_properties; i++) {
-    ScopedLocalRef<jbyteArray> propVal(
-        callbackEnv, callbackEnv->NewByteArray(properties[i].len));
-    if (!propVal.get()) {
-      ALOGE("Error while allocation of array in %s", __func__);
-      return -1;
-    }
+    total += kPackedPropertyHeaderLen + properties[i].len;
+  }
+
+  std::vector<uint8_t> buf;
+  buf.reserve(total);
+  std::vector<jint> offs(num_properties);
+  for (int i = 0; i < num_properties; i++) {
+    offs[i] = buf.size();
+    put_le32(&buf, properties[i].type);
+    put_le32(&buf, properties[i].len);
+    const uint8_t* val = (const uint8_t*)properties[i].val;
+    buf.insert(buf.end(), val, val + properties[i].len);
+  }
 
-    callbackEnv->SetByteArrayRegion(propVal.get(), 0, properties[i].len,
-                                    (jbyte*)properties[i].val);
-    callbackEnv->SetObjectArrayElement(*props, i, propVal.get());
-    callbackEnv->SetIntArrayRegion(*types, i, 1, (jint*)&properties[i].type);
+  packed->reset(env->NewByteArray(buf.size()));
+  offsets->reset(env->NewIntArray(num_properties));
+  if (!packed->get() || !offsets->get()) {
+    ALOGE("Error while allocation of array in %s", __func__);
+    return -1;
   }
+
+  env->SetByteArrayRegion(packed->get(), 0, buf.size(), (jbyte*)buf.data());
+  env->SetIntArrayRegion(offsets->get(), 0, num_properties, offs.data());
   return 0;
 }
 
@@ -124,46 +226,21 @@ static void adapter_properties_callback(bt_status_t status, int num_properties,
     return;
   }
 
-  ScopedLocalRef<jbyteArray> val(
-      sCallbackEnv.get(),
-      (jbyteArray)sCallbackEnv->NewByteArray(num_properties));
-  if (!val.get()) {
-    ALOGE("%s: Error allocating byteArray", __func__);
-    return;
-  }
-
-  ScopedLocalRef<jclass> mclass(sCallbackEnv.get(),
-                                sCallbackEnv->GetObjectClass(val.get()));
-
-  /* (BT) Initialize the jobjectArray and jintArray here itself and send the
-   initialized array pointers alone to get_properties */
-
-  ScopedLocalRef<jobjectArray> props(
-      sCallbackEnv.get(),
-      sCallbackEnv->NewObjectArray(num_properties, mclass.get(), NULL));
-  if (!props.get()) {
-    ALOGE("%s: Error allocating object Array for properties", __func__);
-    return;
-  }
-
-  ScopedLocalRef<jintArray> types(
-      sCallbackEnv.get(), (jintArray)sCallbackEnv->NewIntArray(num_properties));
-  if (!types.get()) {
-    ALOGE("%s: Error allocating int Array for values", __func__);
-    return;
-  }
-
-  jintArray typesPtr = types.get();
-  jobjectArray propsPtr = props.get();
-  if (get_properties(num_properties, properties, &typesPtr, &propsPtr) < 0) {
+  ScopedLocalRef<jbyteArray> packed(sCallbackEnv.get(), NULL);
+  ScopedLocalRef<jintArray> offsets(sCallbackEnv.get(), NULL);
+  if (pack_properties(sCallbackEnv.get(), num_properties, properties, &packed,
+                      &offsets) < 0) {
     return;
   }
 
   sCallbackEnv->CallVoidMethod(sJniCallbacksObj,
                                method_adapterPropertyChangedCallback,
-                               types.get(), props.get());
+                               packed.get(), offsets.get());
 }
 
+static constexpr size_t kRemotePropsMax = 256;
+static RemotePropsCache sRemoteProps(kRemotePropsMax);
+
 static void remote_device_properties_callback(bt_status_t status,
                                               RawAddress* bd_addr,
                                               int num_properties,
@@ -178,54 +255,77 @@ static void remote_device_properties_callback(bt_status_t status,
     return;
   }
 
-  ScopedLocalRef<jbyteArray> val(
-      sCallbackEnv.get(),
-      (jbyteArray)sCallbackEnv->NewByteArray(num_properties));
-  if (!val.get()) {
-    ALOGE("%s: Error allocating byteArray", __func__);
-    return;
-  }
-
-  ScopedLocalRef<jclass> mclass(sCallbackEnv.get(),
-                                sCallbackEnv->GetObjectClass(val.get()));
-
-  /* Initialize the jobjectArray and jintArray here itself and send the
-   initialized array pointers alone to get_properties */
-
-  ScopedLocalRef<jobjectArray> props(
-      sCallbackEnv.get(),
-      sCallbackEnv->NewObjectArray(num_properties, mclass.get(), NULL));
-  if (!props.get()) {
-    ALOGE("%s: Error allocating object Array for properties", __func__);
+  if (!bd_addr) {
+    ALOGE("Address is null in %s", __func__);
     return;
   }
 
-  ScopedLocalRef<jintArray> types(
-      sCallbackEnv.get(), (jintArray)sCallbackEnv->NewIntArray(num_properties));
-  if (!types.get()) {
-    ALOGE("%s: Error allocating int Array for values", __func__);
-    return;
-  }
+  std::vector<bt_property_t> changed =
+      sRemoteProps.filter(*bd_addr, num_properties, properties);
+  if (changed.empty()) return;
 
   ScopedLocalRef<jbyteArray> addr(
       sCallbackEnv.get(), sCallbackEnv->NewByteArray(sizeof(RawAddress)));
   if (!addr.get()) {
     ALOGE("Error while allocation byte array in %s", __func__);
+    sRemoteProps.forget(bd_addr, REMOTE_PROPS_ALL);
     return;
   }
 
   sCallbackEnv->SetByteArrayRegion(addr.get(), 0, sizeof(RawAddress),
                                    (jbyte*)bd_addr);
 
-  jintArray typesPtr = types.get();
-  jobjectArray propsPtr = props.get();
-  if (get_properties(num_properties, properties, &typesPtr, &propsPtr) < 0) {
+  ScopedLocalRef<jbyteArray> packed(sCallbackEnv.get(), NULL);
+  ScopedLocalRef<jintArray> offsets(sCallbackEnv.get(), NULL);
+  if (pack_properties(sCallbackEnv.get(), changed.size(), changed.data(),
+                      &packed, &offsets) < 0) {
+    sRemoteProps.forget(bd_addr, REMOTE_PROPS_ALL);
     return;
   }
 
   sCallbackEnv->CallVoidMethod(sJniCallbacksObj,
                                method_devicePropertyChangedCallback, addr.get(),
-                               types.get(), props.get());
+                               packed.get(), offsets.get());
+}
+
+/* Properties last delivered for each device found in the current discovery
+ * session. Repeated inquiry results only carry what changed since then. */
+static constexpr size_t kDiscoverySeenMax = 512;
+static std::mutex sDiscoverySeenMutex;
+static std::map<RawAddress, std::map<int, std::vector<uint8_t>>>
+    sDiscoverySeen;
+
+static void discovery_seen_clear() {
+  std::lock_guard<std::mutex> lock(sDiscoverySeenMutex);
+  sDiscoverySeen.clear();
+}
+
+/* Returns the properties of an inquiry result that differ from the last
+ * result for |bd_addr| in this discovery session, and remembers them. */
+static std::vector<bt_property_t> discovery_seen_filter(
+    const RawAddress& bd_addr, int num_properties, bt_property_t* properties) {
+  std::lock_guard<std::mutex> lock(sDiscoverySeenMutex);
+  auto it = sDiscoverySeen.find(bd_addr);
+  if (it == sDiscoverySeen.end()) {
+    if (sDiscoverySeen.size() >= kDiscoverySeenMax) {
+      return std::vector<bt_property_t>(properties,
+                                        properties + num_properties);
+    }
+    it = sDiscoverySeen.emplace(bd_addr, std::map<int, std::vector<uint8_t>>())
+             .first;
+  }
+
+  std::vector<bt_property_t> changed;
+  for (int i = 0; i < num_properties; i++) {
+    const uint8_t* val = (const uint8_t*)properties[i].val;
+    std::vector<uint8_t> bytes(val, val + properties[i].len);
+    auto last = it->second.find(properties[i].type);
+    if (last != it->second.end() && last->second == bytes) continue;
+
+    it->second[properties[i].type] = std::move(bytes);
+    changed.push_back(properties[i]);
+  }
+  return changed;
 }
 
 static void device_found_callback(int num_properties,
@@ -233,38 +333,147 @@ static void device_found_callback(int num_properties,
   CallbackEnv sCallbackEnv(__func__);
   if (!sCallbackEnv.valid()) return;
 
-  ScopedLocalRef<jbyteArray> addr(sCallbackEnv.get(), NULL);
-  int addr_index;
+  int addr_index = -1;
   for (int i = 0; i < num_properties; i++) {
-    if (properties[i].type == BT_PROPERTY_BDADDR) {
-      addr.reset(sCallbackEnv->NewByteArray(properties[i].len));
-      if (!addr.get()) {
-        ALOGE("Address is NULL (unable to allocate) in %s", __func__);
-        return;
-      }
-      sCallbackEnv->SetByteArrayRegion(addr.get(), 0, properties[i].len,
-                                       (jbyte*)properties[i].val);
+    if (properties[i].type == BT_PROPERTY_BDADDR &&
+        properties[i].len == sizeof(RawAddress)) {
       addr_index = i;
     }
   }
-  if (!addr.get()) {
+  if (addr_index < 0) {
     ALOGE("Address is NULL in %s", __func__);
     return;
   }
+  RawAddress* bd_addr = (RawAddress*)properties[addr_index].val;
 
   ALOGV("%s: Properties: %d, Address: %s", __func__, num_properties,
-        (const char*)properties[addr_index].val);
+        bd_addr->ToString().c_str());
+
+  std::vector<bt_property_t> changed =
+      discovery_seen_filter(*bd_addr, num_properties, properties);
+  // Java now holds these values, whatever the property cache last sent.
+  for (const bt_property_t& property : changed) {
+    sRemoteProps.forget(bd_addr, property.type);
+  }
+
+  ScopedLocalRef<jbyteArray> addr(
+      sCallbackEnv.get(), sCallbackEnv->NewByteArray(sizeof(RawAddress)));
+  if (!addr.get()) {
+    ALOGE("Address is NULL (unable to allocate) in %s", __func__);
+    return;
+  }
+  sCallbackEnv->SetByteArrayRegion(addr.get(), 0, sizeof(RawAddress),
+                                   (jbyte*)bd_addr);
 
-  remote_device_properties_callback(BT_STATUS_SUCCESS,
-                                    (RawAddress*)properties[addr_index].val,
-                                    num_properties, properties);
+  ScopedLocalRef<jbyteArray> packed(sCallbackEnv.get(), NULL);
+  ScopedLocalRef<jintArray> offsets(sCallbackEnv.get(), NULL);
+  if (pack_properties(sCallbackEnv.get(), changed.size(), changed.data(),
+                      &packed, &offsets) < 0) {
+    return;
+  }
 
-  sCallbackEnv->CallVoidMethod(sJniCallbacksObj, method_deviceFoundCallback,
-                               addr.get());
+  sCallbackEnv->CallVoidMethod(sJniCallbacksObj,
+                               method_deviceFoundWithPropertiesCallback,
+                               addr.get(), packed.get(), offsets.get());
+}
+
+/* Journal of bond, ACL and discovery transitions, always on. Writers claim a
+ * slot with a single atomic increment and publish it through a per-slot
+ * sequence number, so recording never takes a lock; readers skip slots that
+ * are being rewritten. Addresses are kept as their last three bytes. */
+enum JournalEvent : uint8_t {
+  JOURNAL_EVENT_BOND = 1,
+  JOURNAL_EVENT_ACL = 2,
+  JOURNAL_EVENT_DISCOVERY = 3,
+};
+
+struct JournalSlot {
+  // 2 * index + 1 while the entry is written, 2 * index + 2 once published.
+  std::atomic<uint64_t> seq;
+  std::atomic<uint64_t> timestamp_ns;
+  // address id (24 bits) << 24 | event << 16 | status << 8 | state
+  std::atomic<uint64_t> payload;
+};
+
+struct JournalEntry {
+  uint64_t timestamp_ns;
+  uint32_t address_id;
+  uint8_t event;
+  uint8_t status;
+  uint8_t state;
+};
+
+static constexpr size_t kJournalSize = 256;
+
+static JournalSlot sJournal[kJournalSize];
+static std::atomic<uint64_t> sJournalNext(0);
+
+static void journal_record(JournalEvent event, const RawAddress* bd_addr,
+                           int status, int state) {
+  uint64_t index = sJournalNext.fetch_add(1, std::memory_order_relaxed);
+  JournalSlot& slot = sJournal[index % kJournalSize];
+
+  uint64_t address_id = 0;
+  if (bd_addr) {
+    address_id = (bd_addr->address[3] << 16) | (bd_addr->address[4] << 8) |
+                 bd_addr->address[5];
+  }
+  uint64_t timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                           std::chrono::steady_clock::now().time_since_epoch())
+                           .count();
+
+  slot.seq.store(2 * index + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  slot.timestamp_ns.store(timestamp, std::memory_order_relaxed);
+  slot.payload.store(address_id << 24 | (uint64_t)event << 16 |
+                         (uint8_t)status << 8 | (uint8_t)state,
+                     std::memory_order_relaxed);
+  slot.seq.store(2 * index + 2, std::memory_order_release);
+}
+
+// Copies out the published entries, oldest first.
+static std::vector<JournalEntry> journal_snapshot() {
+  std::vector<JournalEntry> entries;
+  uint64_t next = sJournalNext.load(std::memory_order_acquire);
+  uint64_t first = next > kJournalSize ? next - kJournalSize : 0;
+  entries.reserve(next - first);
+  for (uint64_t index = first; index < next; index++) {
+    const JournalSlot& slot = sJournal[index % kJournalSize];
+    uint64_t seq = slot.seq.load(std::memory_order_acquire);
+    if (seq != 2 * index + 2) continue;
+
+    uint64_t timestamp = slot.timestamp_ns.load(std::memory_order_relaxed);
+    uint64_t payload = slot.payload.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (slot.seq.load(std::memory_order_relaxed) != seq) continue;
+
+    entries.push_back({timestamp, (uint32_t)(payload >> 24),
+                       (uint8_t)(payload >> 16), (uint8_t)(payload >> 8),
+                       (uint8_t)payload});
+  }
+  return entries;
+}
+
+static void dump_state_journal(int fd) {
+  static const char* const kEventNames[] = {"?", "BOND", "ACL", "DISCOVERY"};
+  std::vector<JournalEntry> entries = journal_snapshot();
+  dprintf(fd, "\nState journal (%zu entries):\n", entries.size());
+  for (const JournalEntry& entry : entries) {
+    const char* name = entry.event < 4 ? kEventNames[entry.event] : "?";
+    dprintf(fd, "  %llu.%06llu %-9s xx:xx:xx:%02x:%02x:%02x status=%u"
+            " state=%u\n",
+            (unsigned long long)(entry.timestamp_ns / 1000000000),
+            (unsigned long long)(entry.timestamp_ns / 1000 % 1000000), name,
+            (entry.address_id >> 16) & 0xff, (entry.address_id >> 8) & 0xff,
+            entry.address_id & 0xff, entry.status, entry.state);
+  }
 }
 
 static void bond_state_changed_callback(bt_status_t status, RawAddress* bd_addr,
                                         bt_bond_state_t state) {
+  journal_record(JOURNAL_EVENT_BOND, bd_addr, status, state);
+  if (bd_addr) sRemoteProps.onBondStateChanged(*bd_addr);
+
   CallbackEnv sCallbackEnv(__func__);
   if (!sCallbackEnv.valid()) return;
 
@@ -288,6 +497,8 @@ static void bond_state_changed_callback(bt_status_t status, RawAddress* bd_addr,
 
 static void acl_state_changed_callback(bt_status_t status, RawAddress* bd_addr,
                                        bt_acl_state_t state) {
+  journal_record(JOURNAL_EVENT_ACL, bd_addr, status, state);
+
   if (!bd_addr) {
     ALOGE("Address is null in %s", __func__);
     return;
@@ -310,11 +521,16 @@ static void acl_state_changed_callback(bt_status_t status, RawAddress* bd_addr,
 }
 
 static void discovery_state_changed_callback(bt_discovery_state_t state) {
+  journal_record(JOURNAL_EVENT_DISCOVERY, nullptr, BT_STATUS_SUCCESS, state);
+
   CallbackEnv sCallbackEnv(__func__);
   if (!sCallbackEnv.valid()) return;
 
   ALOGV("%s: DiscoveryState:%d ", __func__, state);
 
+  // A new session reports every device in full again.
+  if (state == BT_DISCOVERY_STARTED) discovery_seen_clear();
+
   sCallbackEnv->CallVoidMethod(
       sJniCallbacksObj, method_discoveryStateChangeCallback, (jint)state);
 }
@@ -397,12 +613,14 @@ static void callback_thread_event(bt_cb_thread_evt event) {
     args.name = name;
     args.group = NULL;
     vm->AttachCurrentThread(&callbackEnv, &args);
+    sIsCallbackThread = true;
     ALOGV("Callback thread attached: %p", callbackEnv);
   } else if (event == DISASSOCIATE_JVM) {
-    if (callbackEnv != AndroidRuntime::getJNIEnv()) {
+    if (!sIsCallbackThread) {
       ALOGE("Callback: '%s' is not called on the correct thread", __func__);
       return;
     }
+    sIsCallbackThread = false;
     vm->DetachCurrentThread();
   }
 }
@@ -416,34 +634,207 @@ static void le_test_mode_recv_callback(bt_status_t status,
   ALOGV("%s: status:%d packet_count:%d ", __func__, status, packet_count);
 }
 
+/* Energy readings are deltas since the previous read, whoever asked for it.
+ * Every reading is recorded in a ring buffer of samples, and also added to a
+ * running total that is handed to Java when a read requested by Java
+ * completes. Readings taken by the native sampler therefore never cross into
+ * Java on their own, and Java's totals still include them. */
+struct EnergyUidDelta {
+  int32_t uid;
+  uint64_t rx_bytes;
+  uint64_t tx_bytes;
+};
+
+static constexpr size_t kEnergySampleMaxUids = 8;
+
+struct EnergySample {
+  uint64_t timestamp_ms;
+  uint8_t ctrl_state;
+  uint64_t tx_time;
+  uint64_t rx_time;
+  uint64_t idle_time;
+  uint64_t energy_used;
+  // The heaviest UIDs of the interval, by bytes transferred.
+  size_t num_uids;
+  std::array<EnergyUidDelta, kEnergySampleMaxUids> uids;
+};
+
+static constexpr size_t kEnergyRingSize = 128;
+
+static std::mutex sEnergyMutex;
+static std::array<EnergySample, kEnergyRingSize> sEnergyRing;
+static size_t sEnergyRingNext = 0;
+static size_t sEnergyRingCount = 0;
+static bool sEnergyJavaReadPending = false;
+static EnergySample sEnergyUndelivered = {};
+static std::map<int32_t, EnergyUidDelta> sEnergyUndeliveredUids;
+
+// Serializes starting and stopping the sampler thread, so a stop always joins
+// the thread before a new one can start.
+static std::mutex sEnergySamplerMutex;
+static std::condition_variable sEnergySamplerCv;
+static std::thread sEnergySamplerThread;
+static std::chrono::milliseconds sEnergySamplerInterval(0);
+
+// Sample timestamps, in ms since boot including time spent suspended.
+static uint64_t energy_now_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_BOOTTIME, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Must be called with sEnergyMutex held.
+static void energy_record_locked(const bt_activity_energy_info* info,
+                                 const bt_uid_traffic_t* uid_data) {
+  EnergySample& sample = sEnergyRing[sEnergyRingNext];
+  sEnergyRingNext = (sEnergyRingNext + 1) % kEnergyRingSize;
+  sEnergyRingCount = std::min(sEnergyRingCount + 1, kEnergyRingSize);
+
+  sample.timestamp_ms = energy_now_ms();
+  sample.ctrl_state = info->ctrl_state;
+  sample.tx_time = info->tx_time;
+  sample.rx_time = info->rx_time;
+  sample.idle_time = info->idle_time;
+  sample.energy_used = info->energy_used;
+
+  std::vector<EnergyUidDelta> uids;
+  for (const bt_uid_traffic_t* data = uid_data; data->app_uid != -1; data++) {
+    uids.push_back({data->app_uid, data->rx_bytes, data->tx_bytes});
+    EnergyUidDelta& total = sEnergyUndeliveredUids[data->app_uid];
+    total.uid = data->app_uid;
+    total.rx_bytes += data->rx_bytes;
+    total.tx_bytes += data->tx_bytes;
+  }
+  sample.num_uids = std::min(uids.size(), kEnergySampleMaxUids);
+  std::partial_sort(uids.begin(), uids.begin() + sample.num_uids, uids.end(),
+                    [](const EnergyUidDelta& a, const EnergyUidDelta& b) {
+                      return a.rx_bytes + a.tx_bytes > b.rx_bytes + b.tx_bytes;
+                    });
+  std::copy(uids.begin(), uids.begin() + sample.num_uids, sample.uids.begin());
+
+  sEnergyUndelivered.ctrl_state = info->ctrl_state;
+  sEnergyUndelivered.tx_time += info->tx_time;
+  sEnergyUndelivered.rx_time += info->rx_time;
+  sEnergyUndelivered.idle_time += info->idle_time;
+  sEnergyUndelivered.energy_used += info->energy_used;
+}
+
 static void energy_info_recv_callback(bt_activity_energy_info* p_energy_info,
                                       bt_uid_traffic_t* uid_data) {
+  EnergySample total;
+  std::vector<EnergyUidDelta> uids;
+  {
+    std::lock_guard<std::mutex> lock(sEnergyMutex);
+    energy_record_locked(p_energy_info, uid_data);
+    if (!sEnergyJavaReadPending) return;
+
+    sEnergyJavaReadPending = false;
+    total = sEnergyUndelivered;
+    sEnergyUndelivered = {};
+    for (const auto& entry : sEnergyUndeliveredUids) {
+      uids.push_back(entry.second);
+    }
+    sEnergyUndeliveredUids.clear();
+  }
+
   CallbackEnv sCallbackEnv(__func__);
   if (!sCallbackEnv.valid()) return;
 
-  jsize len = 0;
-  for (bt_uid_traffic_t* data = uid_data; data->app_uid != -1; data++) {
-    len++;
-  }
-
   ScopedLocalRef<jobjectArray> array(
-      sCallbackEnv.get(), sCallbackEnv->NewObjectArray(
-                              len, android_bluetooth_UidTraffic.clazz, NULL));
+      sCallbackEnv.get(),
+      sCallbackEnv->NewObjectArray(uids.size(),
+                                   android_bluetooth_UidTraffic.clazz, NULL));
   jsize i = 0;
-  for (bt_uid_traffic_t* data = uid_data; data->app_uid != -1; data++) {
+  for (const EnergyUidDelta& data : uids) {
     ScopedLocalRef<jobject> uidObj(
         sCallbackEnv.get(),
         sCallbackEnv->NewObject(android_bluetooth_UidTraffic.clazz,
                                 android_bluetooth_UidTraffic.constructor,
-                                (jint)data->app_uid, (jlong)data->rx_bytes,
-                                (jlong)data->tx_bytes));
+                                (jint)data.uid, (jlong)data.rx_bytes,
+                                (jlong)data.tx_bytes));
     sCallbackEnv->SetObjectArrayElement(array.get(), i++, uidObj.get());
   }
 
   sCallbackEnv->CallVoidMethod(
       sJniAdapterServiceObj, method_energyInfo, p_energy_info->status,
-      p_energy_info->ctrl_state, p_energy_info->tx_time, p_energy_info->rx_time,
-      p_energy_info->idle_time, p_energy_info->energy_used, array.get());
+      total.ctrl_state, total.tx_time, total.rx_time, total.idle_time,
+      total.energy_used, array.get());
+}
+
+static void energy_sampler_thread() {
+  std::unique_lock<std::mutex> lock(sEnergyMutex);
+  while (sEnergySamplerInterval.count() > 0) {
+    auto interval = sEnergySamplerInterval;
+    if (sEnergySamplerCv.wait_for(lock, interval) ==
+            std::cv_status::no_timeout ||
+        sEnergySamplerInterval.count() == 0) {
+      // Woken early: the interval changed or sampling stopped.
+      continue;
+    }
+
+    lock.unlock();
+    if (sBluetoothInterface) sBluetoothInterface->read_energy_info();
+    lock.lock();
+  }
+}
+
+// Must be called with sEnergySamplerMutex held.
+static void energy_sampler_stop_locked() {
+  {
+    std::lock_guard<std::mutex> lock(sEnergyMutex);
+    sEnergySamplerInterval = std::chrono::milliseconds(0);
+  }
+  sEnergySamplerCv.notify_one();
+  if (sEnergySamplerThread.joinable()) sEnergySamplerThread.join();
+}
+
+static void energy_sampler_stop() {
+  std::lock_guard<std::mutex> control(sEnergySamplerMutex);
+  energy_sampler_stop_locked();
+}
+
+static void setEnergySamplingIntervalNative(JNIEnv* env, jobject obj,
+                                            jint interval_ms) {
+  ALOGV("%s: %d ms", __func__, interval_ms);
+  std::lock_guard<std::mutex> control(sEnergySamplerMutex);
+  if (interval_ms <= 0) {
+    energy_sampler_stop_locked();
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(sEnergyMutex);
+    sEnergySamplerInterval = std::chrono::milliseconds(interval_ms);
+  }
+  if (sEnergySamplerThread.joinable()) {
+    // Already sampling; wake it to pick up the new interval.
+    sEnergySamplerCv.notify_one();
+    return;
+  }
+  sEnergySamplerThread = std::thread(energy_sampler_thread);
+}
+
+static void dump_energy_samples(int fd) {
+  std::lock_guard<std::mutex> lock(sEnergyMutex);
+  dprintf(fd, "\nEnergy samples (%zu, interval %lld ms):\n", sEnergyRingCount,
+          (long long)sEnergySamplerInterval.count());
+  size_t first =
+      (sEnergyRingNext + kEnergyRingSize - sEnergyRingCount) % kEnergyRingSize;
+  for (size_t n = 0; n < sEnergyRingCount; n++) {
+    const EnergySample& sample = sEnergyRing[(first + n) % kEnergyRingSize];
+    dprintf(fd, "  %llu state=%u tx=%llu rx=%llu idle=%llu energy=%llu",
+            (unsigned long long)sample.timestamp_ms, sample.ctrl_state,
+            (unsigned long long)sample.tx_time,
+            (unsigned long long)sample.rx_time,
+            (unsigned long long)sample.idle_time,
+            (unsigned long long)sample.energy_used);
+    for (size_t i = 0; i < sample.num_uids; i++) {
+      dprintf(fd, " uid%d=%llu/%llu", sample.uids[i].uid,
+              (unsigned long long)sample.uids[i].rx_bytes,
+              (unsigned long long)sample.uids[i].tx_bytes);
+    }
+    dprintf(fd, "\n");
+  }
 }
 
 static bt_callbacks_t sBluetoothCallbacks = {
@@ -455,28 +846,40 @@ static bt_callbacks_t sBluetoothCallbacks = {
     callback_thread_event,       dut_mode_recv_callback,
     le_test_mode_recv_callback,  energy_info_recv_callback};
 
-// The callback to call when the wake alarm fires.
-static alarm_cb sAlarmCallback;
+/* Stack threads that call out into Java stay attached to the VM until they
+ * exit; the thread-specific key's destructor detaches them. */
+static pthread_key_t sJniDetachKey;
+static pthread_once_t sJniDetachKeyOnce = PTHREAD_ONCE_INIT;
+static std::atomic<uint64_t> sJniAttachCount(0);
+
+static void jni_detach_thread(void* vm) {
+  static_cast<JavaVM*>(vm)->DetachCurrentThread();
+}
 
-// The data to pass to the wake alarm callback.
-static void* sAlarmCallbackData;
+static void jni_create_detach_key() {
+  int err = pthread_key_create(&sJniDetachKey, jni_detach_thread);
+  if (err != 0) {
+    ALOGE("JNIThreadAttacher: unable to create detach key, error: %s",
+          strerror(err));
+  }
+}
 
 class JNIThreadAttacher {
  public:
   JNIThreadAttacher() : vm_(nullptr), env_(nullptr) {
     vm_ = AndroidRuntime::getJavaVM();
-    status_ = vm_->GetEnv((void**)&env_, JNI_VERSION_1_6);
+    jint status = vm_->GetEnv((void**)&env_, JNI_VERSION_1_6);
 
-    if (status_ != JNI_OK && status_ != JNI_EDETACHED) {
+    if (status != JNI_OK && status != JNI_EDETACHED) {
       ALOGE(
           "JNIThreadAttacher: unable to get environment for JNI CALL, "
           "status: %d",
-          status_);
+          status);
       env_ = nullptr;
       return;
     }
 
-    if (status_ == JNI_EDETACHED) {
+    if (status == JNI_EDETACHED) {
       char name[17] = {0};
       if (prctl(PR_GET_NAME, (unsigned long)name) != 0) {
         ALOGE(
@@ -493,11 +896,19 @@ class JNIThreadAttacher {
         env_ = nullptr;
         return;
       }
+      sJniAttachCount++;
+
+      pthread_once(&sJniDetachKeyOnce, jni_create_detach_key);
+      if (pthread_setspecific(sJniDetachKey, vm_) != 0) {
+        // Without the key the thread could exit attached; detach right away.
+        ALOGE("JNIThreadAttacher: unable to register detach, detaching now");
+        detach_ = true;
+      }
     }
   }
 
   ~JNIThreadAttacher() {
-    if (status_ == JNI_EDETACHED) vm_->DetachCurrentThread();
+    if (detach_) vm_->DetachCurrentThread();
   }
 
   JNIEnv* getEnv() { return env_; }
@@ -505,35 +916,261 @@ class JNIThreadAttacher {
  private:
   JavaVM* vm_;
   JNIEnv* env_;
-  jint status_;
+  bool detach_ = false;
+};
+
+static void dump_jni_attach_stats(int fd) {
+  dprintf(fd, "\nJNI thread attaches by callouts: %llu\n",
+          (unsigned long long)sJniAttachCount.load());
+}
+
+/* Stack alarms are kept natively in two min-heaps. Alarms that may wake the
+ * device are handed to Java one at a time: only the earliest is armed through
+ * setWakeAlarm. A timerfd on CLOCK_BOOTTIME tracks the earliest alarm of
+ * either kind while the device is awake, so most alarms never reach Java.
+ * An alarm set again for the same callback and data replaces the pending
+ * one, as a single-slot alarm did before. */
+struct StackAlarm {
+  uint64_t deadline_ms;
+  alarm_cb cb;
+  void* data;
 };
 
+static bool alarm_later(const StackAlarm& a, const StackAlarm& b) {
+  return a.deadline_ms > b.deadline_ms;
+}
+
+static constexpr uint64_t kAlarmNone = UINT64_MAX;
+
+// Serializes setWakeAlarm calls so an older deadline cannot overwrite a newer
+// one in Java. Always taken before sAlarmMutex, which is never held across a
+// JNI call.
+static std::mutex sAlarmJavaMutex;
+static std::mutex sAlarmMutex;
+static std::vector<StackAlarm> sWakeAlarms;
+static std::vector<StackAlarm> sTimerAlarms;
+static uint64_t sJavaAlarmDeadline = kAlarmNone;
+static int sAlarmTimerFd = -1;
+static int sAlarmStopFd = -1;
+static std::thread sAlarmThread;
+
+static uint64_t alarm_now_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_BOOTTIME, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void alarm_remove_locked(std::vector<StackAlarm>* heap, alarm_cb cb,
+                                void* data) {
+  auto it = std::remove_if(heap->begin(), heap->end(),
+                           [cb, data](const StackAlarm& alarm) {
+                             return alarm.cb == cb && alarm.data == data;
+                           });
+  if (it == heap->end()) return;
+  heap->erase(it, heap->end());
+  std::make_heap(heap->begin(), heap->end(), alarm_later);
+}
+
+static uint64_t alarm_front_locked(const std::vector<StackAlarm>& heap) {
+  return heap.empty() ? kAlarmNone : heap.front().deadline_ms;
+}
+
+// Arms the timerfd for the earliest alarm. Must be called with sAlarmMutex
+// held.
+static void alarm_rearm_timer_locked() {
+  uint64_t next = std::min(alarm_front_locked(sWakeAlarms),
+                           alarm_front_locked(sTimerAlarms));
+  if (sAlarmTimerFd >= 0) {
+    struct itimerspec spec = {};
+    if (next != kAlarmNone) {
+      // A zero it_value would disarm the timer; expired alarms fire at once.
+      uint64_t at = std::max<uint64_t>(next, 1);
+      spec.it_value.tv_sec = at / 1000;
+      spec.it_value.tv_nsec = (at % 1000) * 1000000;
+    }
+    if (timerfd_settime(sAlarmTimerFd, TFD_TIMER_ABSTIME, &spec, NULL) != 0) {
+      ALOGE("%s: unable to arm alarm timer: %s", __func__, strerror(errno));
+    }
+  }
+}
+
+// Hands the earliest wake alarm to Java unless it is already armed there. On
+// failure |failed| is set to the alarm Java refused. Must be called with
+// sAlarmJavaMutex held and sAlarmMutex not held.
+static bool alarm_sync_java(StackAlarm* failed) {
+  StackAlarm wake;
+  {
+    std::lock_guard<std::mutex> lock(sAlarmMutex);
+    if (sWakeAlarms.empty()) return true;
+    wake = sWakeAlarms.front();
+    if (wake.deadline_ms == sJavaAlarmDeadline) return true;
+  }
+
+  jboolean ret = JNI_FALSE;
+  {
+    JNIThreadAttacher attacher;
+    JNIEnv* env = attacher.getEnv();
+    if (env == nullptr) {
+      ALOGE("%s: Unable to get JNI Env", __func__);
+    } else {
+      uint64_t now = alarm_now_ms();
+      jlong delay_millis =
+          wake.deadline_ms > now ? wake.deadline_ms - now : 0;
+      ret = env->CallBooleanMethod(sJniAdapterServiceObj, method_setWakeAlarm,
+                                   delay_millis, JNI_TRUE);
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(sAlarmMutex);
+  sJavaAlarmDeadline = ret ? wake.deadline_ms : kAlarmNone;
+  if (!ret && failed) *failed = wake;
+  return (ret == JNI_TRUE);
+}
+
 static bool set_wake_alarm_callout(uint64_t delay_millis, bool should_wake,
                                    alarm_cb cb, void* data) {
-  JNIThreadAttacher attacher;
-  JNIEnv* env = attacher.getEnv();
+  std::lock_guard<std::mutex> java_lock(sAlarmJavaMutex);
+  std::vector<StackAlarm>* heap;
+  {
+    std::lock_guard<std::mutex> lock(sAlarmMutex);
+    alarm_remove_locked(&sWakeAlarms, cb, data);
+    alarm_remove_locked(&sTimerAlarms, cb, data);
 
-  if (env == nullptr) {
-    ALOGE("%s: Unable to get JNI Env", __func__);
-    return false;
+    // Without the timer every alarm has to go through Java.
+    bool wake = should_wake || sAlarmTimerFd < 0;
+    heap = wake ? &sWakeAlarms : &sTimerAlarms;
+    heap->push_back({alarm_now_ms() + delay_millis, cb, data});
+    std::push_heap(heap->begin(), heap->end(), alarm_later);
+    alarm_rearm_timer_locked();
   }
 
-  sAlarmCallback = cb;
-  sAlarmCallbackData = data;
+  StackAlarm failed = {};
+  if (alarm_sync_java(&failed)) return true;
+
+  // Only fail this call if Java refused this alarm; an earlier alarm that
+  // Java refused has already been reported to its own caller.
+  if (failed.cb != cb || failed.data != data) return true;
 
-  jboolean jshould_wake = should_wake ? JNI_TRUE : JNI_FALSE;
-  jboolean ret =
-      env->CallBooleanMethod(sJniAdapterServiceObj, method_setWakeAlarm,
-                             (jlong)delay_millis, jshould_wake);
-  if (!ret) {
-    sAlarmCallback = NULL;
-    sAlarmCallbackData = NULL;
+  // Java could not take the alarm; the stack retries or falls back.
+  std::lock_guard<std::mutex> lock(sAlarmMutex);
+  alarm_remove_locked(heap, cb, data);
+  return false;
+}
+
+// Runs every alarm that is due, whichever way it was armed.
+static void alarm_dispatch_expired() {
+  std::vector<StackAlarm> expired;
+  {
+    std::lock_guard<std::mutex> lock(sAlarmMutex);
+    uint64_t now = alarm_now_ms();
+    for (auto* heap : {&sWakeAlarms, &sTimerAlarms}) {
+      while (!heap->empty() && heap->front().deadline_ms <= now) {
+        std::pop_heap(heap->begin(), heap->end(), alarm_later);
+        expired.push_back(heap->back());
+        heap->pop_back();
+      }
+    }
+    alarm_rearm_timer_locked();
+  }
+  {
+    std::lock_guard<std::mutex> java_lock(sAlarmJavaMutex);
+    alarm_sync_java(nullptr);
   }
 
-  return (ret == JNI_TRUE);
+  std::sort(expired.begin(), expired.end(),
+            [](const StackAlarm& a, const StackAlarm& b) {
+              return a.deadline_ms < b.deadline_ms;
+            });
+  for (const StackAlarm& alarm : expired) alarm.cb(alarm.data);
 }
 
-static int acquire_wake_lock_callout(const char* lock_name) {
+static void alarm_thread() {
+  struct pollfd fds[2] = {{sAlarmTimerFd, POLLIN, 0},
+                          {sAlarmStopFd, POLLIN, 0}};
+  while (true) {
+    if (poll(fds, 2, -1) < 0) {
+      if (errno == EINTR) continue;
+      ALOGE("%s: poll failed: %s", __func__, strerror(errno));
+      return;
+    }
+    if (fds[1].revents) return;
+    if (fds[0].revents & POLLIN) {
+      uint64_t expirations;
+      if (read(sAlarmTimerFd, &expirations, sizeof(expirations)) < 0) continue;
+      alarm_dispatch_expired();
+    }
+  }
+}
+
+static void alarm_init() {
+  if (sAlarmThread.joinable()) {
+    ALOGW("%s: alarm thread already running", __func__);
+    return;
+  }
+
+  sAlarmTimerFd = timerfd_create(CLOCK_BOOTTIME, TFD_CLOEXEC);
+  sAlarmStopFd = eventfd(0, EFD_CLOEXEC);
+  if (sAlarmTimerFd < 0 || sAlarmStopFd < 0) {
+    // Alarms still work, but every one of them goes through Java.
+    ALOGE("%s: unable to create alarm fds: %s", __func__, strerror(errno));
+    for (int* fd : {&sAlarmTimerFd, &sAlarmStopFd}) {
+      if (*fd >= 0) close(*fd);
+      *fd = -1;
+    }
+    return;
+  }
+  sAlarmThread = std::thread(alarm_thread);
+}
+
+static void alarm_cleanup() {
+  if (sAlarmThread.joinable()) {
+    uint64_t stop = 1;
+    if (write(sAlarmStopFd, &stop, sizeof(stop)) < 0) {
+      ALOGE("%s: unable to stop alarm thread: %s", __func__, strerror(errno));
+    }
+    sAlarmThread.join();
+  }
+
+  std::lock_guard<std::mutex> lock(sAlarmMutex);
+  sWakeAlarms.clear();
+  sTimerAlarms.clear();
+  sJavaAlarmDeadline = kAlarmNone;
+  for (int* fd : {&sAlarmTimerFd, &sAlarmStopFd}) {
+    if (*fd >= 0) close(*fd);
+    *fd = -1;
+  }
+}
+
+/* Wake locks are refcounted by name so that Java only sees the first acquire
+ * and the last release. The last release is held off for a short while; an
+ * acquire within that window keeps the Java lock instead of cycling it. */
+struct WakeLockState {
+  int refs = 0;
+  bool held = false;
+  bool release_pending = false;
+  std::chrono::steady_clock::time_point release_at;
+  std::chrono::steady_clock::time_point held_since;
+  uint64_t acquires = 0;
+  uint64_t java_acquires = 0;
+  std::chrono::milliseconds total_held{0};
+  std::chrono::milliseconds max_held{0};
+};
+
+#define PROPERTY_WAKE_LOCK_HOLDOFF_MS "persist.bluetooth.wakelock_holdoff_ms"
+#define DEFAULT_WAKE_LOCK_HOLDOFF_MS 100
+
+// Serializes the Java acquire and release calls so they reach Java in the
+// order the refcounts changed. Always taken before sWakeLockMutex, which is
+// never held across a JNI call.
+static std::mutex sWakeLockJavaMutex;
+static std::mutex sWakeLockMutex;
+static std::condition_variable sWakeLockCv;
+static std::map<std::string, WakeLockState> sWakeLocks;
+static std::chrono::milliseconds sWakeLockHoldoff(DEFAULT_WAKE_LOCK_HOLDOFF_MS);
+static std::thread sWakeLockThread;
+static bool sWakeLockThreadRunning = false;
+
+static int call_wake_lock_method(jmethodID method, const char* lock_name) {
   JNIThreadAttacher attacher;
   JNIEnv* env = attacher.getEnv();
 
@@ -546,9 +1183,9 @@ static int acquire_wake_lock_callout(const char* lock_name) {
   {
     ScopedLocalRef<jstring> lock_name_jni(env, env->NewStringUTF(lock_name));
     if (lock_name_jni.get()) {
-      bool acquired = env->CallBooleanMethod(
-          sJniAdapterServiceObj, method_acquireWakeLock, lock_name_jni.get());
-      if (!acquired) ret = BT_STATUS_WAKELOCK_ERROR;
+      bool ok = env->CallBooleanMethod(sJniAdapterServiceObj, method,
+                                       lock_name_jni.get());
+      if (!ok) ret = BT_STATUS_WAKELOCK_ERROR;
     } else {
       ALOGE("%s unable to allocate string: %s", __func__, lock_name);
       ret = BT_STATUS_NOMEM;
@@ -558,39 +1195,185 @@ static int acquire_wake_lock_callout(const char* lock_name) {
   return ret;
 }
 
-static int release_wake_lock_callout(const char* lock_name) {
-  JNIThreadAttacher attacher;
-  JNIEnv* env = attacher.getEnv();
+// Acquires or releases the Java lock for |name| so that it is held exactly
+// while the lock has references or a pending release. Must be called with
+// sWakeLockJavaMutex held and sWakeLockMutex not held.
+static int wake_lock_sync(const std::string& name) {
+  bool acquire;
+  {
+    std::lock_guard<std::mutex> lock(sWakeLockMutex);
+    auto it = sWakeLocks.find(name);
+    if (it == sWakeLocks.end()) return BT_STATUS_SUCCESS;
+    const WakeLockState& state = it->second;
+    acquire = state.refs > 0 || state.release_pending;
+    if (acquire == state.held) return BT_STATUS_SUCCESS;
+  }
+
+  int ret = call_wake_lock_method(
+      acquire ? method_acquireWakeLock : method_releaseWakeLock, name.c_str());
+
+  std::lock_guard<std::mutex> lock(sWakeLockMutex);
+  WakeLockState& state = sWakeLocks[name];
+  auto now = std::chrono::steady_clock::now();
+  if (acquire) {
+    if (ret != BT_STATUS_SUCCESS) return ret;
+    state.held = true;
+    state.held_since = now;
+    state.java_acquires++;
+  } else {
+    auto held = std::chrono::duration_cast<std::chrono::milliseconds>(
+        now - state.held_since);
+    state.held = false;
+    state.total_held += held;
+    state.max_held = std::max(state.max_held, held);
+  }
+  return ret;
+}
 
-  if (env == nullptr) {
-    ALOGE("%s: Unable to get JNI Env", __func__);
-    return BT_STATUS_JNI_THREAD_ATTACH_ERROR;
+static void wake_lock_thread() {
+  std::unique_lock<std::mutex> lock(sWakeLockMutex);
+  while (sWakeLockThreadRunning) {
+    auto next = std::chrono::steady_clock::time_point::max();
+    auto now = std::chrono::steady_clock::now();
+    std::vector<std::string> expired;
+    for (auto& entry : sWakeLocks) {
+      WakeLockState& state = entry.second;
+      if (!state.release_pending) continue;
+      if (state.release_at <= now) {
+        state.release_pending = false;
+        expired.push_back(entry.first);
+      } else {
+        next = std::min(next, state.release_at);
+      }
+    }
+
+    if (!expired.empty()) {
+      lock.unlock();
+      {
+        std::lock_guard<std::mutex> java_lock(sWakeLockJavaMutex);
+        for (const std::string& name : expired) wake_lock_sync(name);
+      }
+      lock.lock();
+      continue;
+    }
+
+    if (next == std::chrono::steady_clock::time_point::max()) {
+      sWakeLockCv.wait(lock);
+    } else {
+      sWakeLockCv.wait_until(lock, next);
+    }
   }
+}
 
-  jint ret = BT_STATUS_SUCCESS;
+static void wake_lock_init() {
+  std::lock_guard<std::mutex> lock(sWakeLockMutex);
+  sWakeLockHoldoff = std::chrono::milliseconds(std::max(
+      0, property_get_int32(PROPERTY_WAKE_LOCK_HOLDOFF_MS,
+                            DEFAULT_WAKE_LOCK_HOLDOFF_MS)));
+}
+
+// Called once the stack is gone: drops its references, releases anything
+// still held and stops the release thread.
+static void wake_lock_shutdown() {
   {
-    ScopedLocalRef<jstring> lock_name_jni(env, env->NewStringUTF(lock_name));
-    if (lock_name_jni.get()) {
-      bool released = env->CallBooleanMethod(
-          sJniAdapterServiceObj, method_releaseWakeLock, lock_name_jni.get());
-      if (!released) ret = BT_STATUS_WAKELOCK_ERROR;
-    } else {
-      ALOGE("%s unable to allocate string: %s", __func__, lock_name);
-      ret = BT_STATUS_NOMEM;
+    std::lock_guard<std::mutex> java_lock(sWakeLockJavaMutex);
+    std::vector<std::string> names;
+    {
+      std::lock_guard<std::mutex> lock(sWakeLockMutex);
+      for (auto& entry : sWakeLocks) {
+        entry.second.refs = 0;
+        entry.second.release_pending = false;
+        names.push_back(entry.first);
+      }
+      sWakeLockThreadRunning = false;
     }
+    for (const std::string& name : names) wake_lock_sync(name);
+  }
+  sWakeLockCv.notify_one();
+  if (sWakeLockThread.joinable()) sWakeLockThread.join();
+}
+
+static int acquire_wake_lock_callout(const char* lock_name) {
+  std::lock_guard<std::mutex> java_lock(sWakeLockJavaMutex);
+  std::string name(lock_name);
+  {
+    std::lock_guard<std::mutex> lock(sWakeLockMutex);
+    WakeLockState& state = sWakeLocks[name];
+    state.acquires++;
+    if (state.refs++ > 0) return BT_STATUS_SUCCESS;
+
+    // Reacquired within the hold-off window; the Java lock is still held.
+    state.release_pending = false;
+    if (state.held) return BT_STATUS_SUCCESS;
   }
 
+  int ret = wake_lock_sync(name);
+  if (ret != BT_STATUS_SUCCESS) {
+    std::lock_guard<std::mutex> lock(sWakeLockMutex);
+    sWakeLocks[name].refs--;
+  }
   return ret;
 }
 
+static int release_wake_lock_callout(const char* lock_name) {
+  std::lock_guard<std::mutex> java_lock(sWakeLockJavaMutex);
+  std::string name(lock_name);
+  {
+    std::lock_guard<std::mutex> lock(sWakeLockMutex);
+    auto it = sWakeLocks.find(name);
+    if (it == sWakeLocks.end() || it->second.refs == 0) {
+      ALOGW("%s: %s released more often than acquired", __func__, lock_name);
+      return BT_STATUS_SUCCESS;
+    }
+
+    WakeLockState& state = it->second;
+    if (--state.refs > 0) return BT_STATUS_SUCCESS;
+
+    if (sWakeLockHoldoff.count() > 0) {
+      state.release_pending = true;
+      state.release_at = std::chrono::steady_clock::now() + sWakeLockHoldoff;
+      if (!sWakeLockThreadRunning) {
+        sWakeLockThreadRunning = true;
+        sWakeLockThread = std::thread(wake_lock_thread);
+      }
+      sWakeLockCv.notify_one();
+      return BT_STATUS_SUCCESS;
+    }
+  }
+
+  return wake_lock_sync(name);
+}
+
+static void dump_wake_locks(int fd) {
+  std::lock_guard<std::mutex> lock(sWakeLockMutex);
+  dprintf(fd, "\nWake locks (hold-off %lld ms)\n",
+          (long long)sWakeLockHoldoff.count());
+  auto now = std::chrono::steady_clock::now();
+  for (const auto& entry : sWakeLocks) {
+    const WakeLockState& state = entry.second;
+    auto total = state.total_held;
+    if (state.held) {
+      total += std::chrono::duration_cast<std::chrono::milliseconds>(
+          now - state.held_since);
+    }
+    dprintf(fd,
+            "  %s: refs=%d held=%d acquires=%llu java_acquires=%llu "
+            "total_held_ms=%lld max_held_ms=%lld\n",
+            entry.first.c_str(), state.refs, state.held,
+            (unsigned long long)state.acquires,
+            (unsigned long long)state.java_acquires, (long long)total.count(),
+            (long long)state.max_held.count());
+  }
+}
+
 // Called by Java code when alarm is fired. A wake lock is held by the caller
 // over the duration of this callback.
 static void alarmFiredNative(JNIEnv* env, jobject obj) {
-  if (sAlarmCallback) {
-    sAlarmCallback(sAlarmCallbackData);
-  } else {
-    ALOGE("%s() - Alarm fired with callback not set!", __func__);
+  {
+    std::lock_guard<std::mutex> lock(sAlarmMutex);
+    sJavaAlarmDeadline = kAlarmNone;
   }
+  alarm_dispatch_expired();
 }
 
 static bt_os_callouts_t sBluetoothOsCallouts = {
@@ -637,6 +1420,30 @@ error:
   return -EINVAL;
 }
 
+static const JniMethod sJniCallbacksMethods[] = {
+    {&method_stateChangeCallback, "stateChangeCallback", "(I)V"},
+    {&method_adapterPropertyChangedCallback, "adapterPropertyChangedCallback",
+     "([B[I)V"},
+    {&method_discoveryStateChangeCallback, "discoveryStateChangeCallback",
+     "(I)V"},
+    {&method_devicePropertyChangedCallback, "devicePropertyChangedCallback",
+     "([B[B[I)V"},
+    {&method_deviceFoundWithPropertiesCallback,
+     "deviceFoundWithPropertiesCallback", "([B[B[I)V"},
+    {&method_pinRequestCallback, "pinRequestCallback", "([B[BIZ)V"},
+    {&method_sspRequestCallback, "sspRequestCallback", "([B[BIII)V"},
+    {&method_bondStateChangeCallback, "bondStateChangeCallback", "(I[BI)V"},
+    {&method_aclStateChangeCallback, "aclStateChangeCallback", "(I[BI)V"},
+};
+
+static const JniMethod sAdapterServiceMethods[] = {
+    {&method_setWakeAlarm, "setWakeAlarm", "(JZ)Z"},
+    {&method_acquireWakeLock, "acquireWakeLock", "(Ljava/lang/String;)Z"},
+    {&method_releaseWakeLock, "releaseWakeLock", "(Ljava/lang/String;)Z"},
+    {&method_energyInfo, "energyInfoCallback",
+     "(IIJJJJ[Landroid/bluetooth/UidTraffic;)V"},
+};
+
 static void classInitNative(JNIEnv* env, jclass clazz) {
   jclass jniUidTrafficClass = env->FindClass("android/bluetooth/UidTraffic");
   android_bluetooth_UidTraffic.constructor =
@@ -647,36 +1454,11 @@ static void classInitNative(JNIEnv* env, jclass clazz) {
   sJniCallbacksField = env->GetFieldID(
       clazz, "mJniCallbacks", "Lcom/android/bluetooth/btservice/JniCallbacks;");
 
-  method_stateChangeCallback =
-      env->GetMethodID(jniCallbackClass, "stateChangeCallback", "(I)V");
-
-  method_adapterPropertyChangedCallback = env->GetMethodID(
-      jniCallbackClass, "adapterPropertyChangedCallback", "([I[[B)V");
-  method_discoveryStateChangeCallback = env->GetMethodID(
-      jniCallbackClass, "discoveryStateChangeCallback", "(I)V");
-
-  method_devicePropertyChangedCallback = env->GetMethodID(
-      jniCallbackClass, "devicePropertyChangedCallback", "([B[I[[B)V");
-  method_deviceFoundCallback =
-      env->GetMethodID(jniCallbackClass, "deviceFoundCallback", "([B)V");
-  method_pinRequestCallback =
-      env->GetMethodID(jniCallbackClass, "pinRequestCallback", "([B[BIZ)V");
-  method_sspRequestCallback =
-      env->GetMethodID(jniCallbackClass, "sspRequestCallback", "([B[BIII)V");
-
-  method_bondStateChangeCallback =
-      env->GetMethodID(jniCallbackClass, "bondStateChangeCallback", "(I[BI)V");
-
-  method_aclStateChangeCallback =
-      env->GetMethodID(jniCallbackClass, "aclStateChangeCallback", "(I[BI)V");
-
-  method_setWakeAlarm = env->GetMethodID(clazz, "setWakeAlarm", "(JZ)Z");
-  method_acquireWakeLock =
-      env->GetMethodID(clazz, "acquireWakeLock", "(Ljava/lang/String;)Z");
-  method_releaseWakeLock =
-      env->GetMethodID(clazz, "releaseWakeLock", "(Ljava/lang/String;)Z");
-  method_energyInfo = env->GetMethodID(
-      clazz, "energyInfoCallback", "(IIJJJJ[Landroid/bluetooth/UidTraffic;)V");
+  if (!bindJniMethods(env, jniCallbackClass, sJniCallbacksMethods,
+                      "adapter callbacks") ||
+      !bindJniMethods(env, clazz, sAdapterServiceMethods, "adapter service")) {
+    return;
+  }
 
   if (hal_util_load_bt_library((bt_interface_t const**)&sBluetoothInterface)) {
     ALOGE("No Bluetooth Library found");
@@ -698,11 +1480,15 @@ static bool initNative(JNIEnv* env, jobject obj, jboolean isGuest,
     return JNI_FALSE;
   }
 
+  wake_lock_init();
+  alarm_init();
+
   int ret = sBluetoothInterface->init(&sBluetoothCallbacks,
                                       isGuest == JNI_TRUE ? 1 : 0,
                                       isNiapMode == JNI_TRUE ? 1 : 0);
   if (ret != BT_STATUS_SUCCESS) {
     ALOGE("Error while setting the callbacks: %d\n", ret);
+    alarm_cleanup();
     sBluetoothInterface = NULL;
     return JNI_FALSE;
   }
@@ -710,6 +1496,7 @@ static bool initNative(JNIEnv* env, jobject obj, jboolean isGuest,
   if (ret != BT_STATUS_SUCCESS) {
     ALOGE("Error while setting Bluetooth callouts: %d\n", ret);
     sBluetoothInterface->cleanup();
+    alarm_cleanup();
     sBluetoothInterface = NULL;
     return JNI_FALSE;
   }
@@ -724,14 +1511,46 @@ static bool initNative(JNIEnv* env, jobject obj, jboolean isGuest,
   return JNI_TRUE;
 }
 
+/* Obfuscated addresses handed out by obfuscateAddressNative, kept as global
+ * refs so that repeated lookups for the same device return the same array.
+ * The obfuscation secret lives in the stack's config, so the memo is dropped
+ * on factory reset, which clears the config, and on cleanup. */
+static constexpr size_t kObfuscatedMax = 64;
+
+struct Obfuscated {
+  jbyteArray bytes;
+  std::list<RawAddress>::iterator lru;
+};
+
+static std::mutex sObfuscatedMutex;
+static std::map<RawAddress, Obfuscated> sObfuscated;
+// Most recently requested device first.
+static std::list<RawAddress> sObfuscatedLru;
+
+// Must be called with sObfuscatedMutex held.
+static void obfuscated_clear_locked(JNIEnv* env) {
+  for (auto& entry : sObfuscated) env->DeleteGlobalRef(entry.second.bytes);
+  sObfuscated.clear();
+  sObfuscatedLru.clear();
+}
+
+static void obfuscated_clear(JNIEnv* env) {
+  std::lock_guard<std::mutex> lock(sObfuscatedMutex);
+  obfuscated_clear_locked(env);
+}
+
 static bool cleanupNative(JNIEnv* env, jobject obj) {
   ALOGV("%s", __func__);
 
   if (!sBluetoothInterface) return JNI_FALSE;
 
+  energy_sampler_stop();
   sBluetoothInterface->cleanup();
   ALOGI("%s: return from cleanup", __func__);
 
+  wake_lock_shutdown();
+  alarm_cleanup();
+
   if (sJniCallbacksObj) {
     env->DeleteGlobalRef(sJniCallbacksObj);
     sJniCallbacksObj = NULL;
@@ -746,6 +1565,9 @@ static bool cleanupNative(JNIEnv* env, jobject obj) {
     env->DeleteGlobalRef(android_bluetooth_UidTraffic.clazz);
     android_bluetooth_UidTraffic.clazz = NULL;
   }
+  discovery_seen_clear();
+  sRemoteProps.forget(nullptr, REMOTE_PROPS_ALL);
+  obfuscated_clear(env);
   {
     std::lock_guard<std::mutex> lock(sSocketManagerMutex);
     sSocketManager = nullptr;
@@ -1067,6 +1889,8 @@ static jboolean getDevicePropertyNative(JNIEnv* env, jobject obj,
     return JNI_FALSE;
   }
 
+  // Whatever the read reports is delivered, changed or not.
+  sRemoteProps.forget((RawAddress*)addr, type);
   int ret = sBluetoothInterface->get_remote_device_property(
       (RawAddress*)addr, (bt_property_type_t)type);
   env->ReleaseByteArrayElements(address, addr, 0);
@@ -1118,11 +1942,31 @@ static jboolean getRemoteServicesNative(JNIEnv* env, jobject obj,
     return JNI_FALSE;
   }
 
+  // The services found are reported as UUIDs, changed or not.
+  sRemoteProps.forget((RawAddress*)addr, BT_PROPERTY_UUIDS);
   int ret = sBluetoothInterface->get_remote_services((RawAddress*)addr);
   env->ReleaseByteArrayElements(address, addr, 0);
   return (ret == BT_STATUS_SUCCESS) ? JNI_TRUE : JNI_FALSE;
 }
 
+static void refreshRemoteDevicePropertiesNative(JNIEnv* env, jobject obj,
+                                               jbyteArray address) {
+  ALOGV("%s", __func__);
+
+  if (address == NULL) {
+    sRemoteProps.forget(nullptr, REMOTE_PROPS_ALL);
+    return;
+  }
+
+  jbyte* addr = env->GetByteArrayElements(address, NULL);
+  if (addr == NULL) {
+    jniThrowIOException(env, EINVAL);
+    return;
+  }
+  sRemoteProps.forget((RawAddress*)addr, REMOTE_PROPS_ALL);
+  env->ReleaseByteArrayElements(address, addr, 0);
+}
+
 static jobject getSocketManagerNative(JNIEnv* env) {
   std::lock_guard<std::mutex> lock(sSocketManagerMutex);
   if (!sSocketManager.get()) {
@@ -1138,16 +1982,125 @@ static void setSystemUiUidNative(JNIEnv* env, jobject obj, jint uid) {
 
 static void setForegroundUserIdNative(JNIEnv* env, jclass clazz, jint id) {
   android::bluetooth::foregroundUserId = id;
+  android::bluetooth::clearProfileParentCache();
+  android::bluetooth::clearPermissionCache();
 }
 
 static int readEnergyInfo() {
   ALOGV("%s", __func__);
 
   if (!sBluetoothInterface) return JNI_FALSE;
+  {
+    std::lock_guard<std::mutex> lock(sEnergyMutex);
+    sEnergyJavaReadPending = true;
+  }
   int ret = sBluetoothInterface->read_energy_info();
   return (ret == BT_STATUS_SUCCESS) ? JNI_TRUE : JNI_FALSE;
 }
 
+/* Natives of each profile, registered the first time one of the profile's
+ * classes is loaded rather than all at once when the library is loaded. */
+struct ProfileNatives {
+  const char* name;
+  int (*register_natives)(JNIEnv* env);
+};
+
+static const ProfileNatives kProfileNatives[] = {
+    {"hfp", register_com_android_bluetooth_hfp},
+    {"hfpclient", register_com_android_bluetooth_hfpclient},
+    {"a2dp", register_com_android_bluetooth_a2dp},
+    {"a2dp_sink", register_com_android_bluetooth_a2dp_sink},
+    {"avrcp_target", register_com_android_bluetooth_avrcp_target},
+    {"avrcp_controller", register_com_android_bluetooth_avrcp_controller},
+    {"hid_host", register_com_android_bluetooth_hid_host},
+    {"hid_device", register_com_android_bluetooth_hid_device},
+    {"pan", register_com_android_bluetooth_pan},
+    {"gatt", register_com_android_bluetooth_gatt},
+    {"sdp", register_com_android_bluetooth_sdp},
+    {"hearing_aid", register_com_android_bluetooth_hearing_aid},
+    {"vendor_socket", register_com_android_bluetooth_btservice_vendor_socket},
+};
+
+enum ProfileNativesState {
+  PROFILE_NATIVES_UNREGISTERED = 0,
+  PROFILE_NATIVES_REGISTERING,
+  PROFILE_NATIVES_REGISTERED,
+  PROFILE_NATIVES_FAILED,
+};
+
+struct ProfileNativesStatus {
+  ProfileNativesState state;
+  std::chrono::microseconds register_time;
+  std::chrono::milliseconds registered_at;  // since the library was loaded
+};
+
+static ProfileNativesStatus sProfileNativesStatus[NELEM(kProfileNatives)];
+// Recursive, as registering a class may load another class of the profile.
+static std::recursive_mutex sProfileNativesMutex;
+static std::chrono::steady_clock::time_point sJniLoadedAt;
+
+static jboolean registerProfileNativesNative(JNIEnv* env, jclass clazz,
+                                             jstring profile) {
+  const char* name = env->GetStringUTFChars(profile, NULL);
+  if (name == NULL) return JNI_FALSE;
+
+  size_t index = 0;
+  while (index < NELEM(kProfileNatives) &&
+         strcmp(kProfileNatives[index].name, name)) {
+    index++;
+  }
+  env->ReleaseStringUTFChars(profile, name);
+  if (index == NELEM(kProfileNatives)) {
+    ALOGE("%s: unknown profile", __func__);
+    return JNI_FALSE;
+  }
+
+  const ProfileNatives& natives = kProfileNatives[index];
+  ProfileNativesStatus& status = sProfileNativesStatus[index];
+  std::lock_guard<std::recursive_mutex> lock(sProfileNativesMutex);
+  if (status.state != PROFILE_NATIVES_UNREGISTERED) {
+    return status.state != PROFILE_NATIVES_FAILED;
+  }
+
+  status.state = PROFILE_NATIVES_REGISTERING;
+  auto start = std::chrono::steady_clock::now();
+  int ret = natives.register_natives(env);
+  auto end = std::chrono::steady_clock::now();
+
+  using std::chrono::duration_cast;
+  status.register_time = duration_cast<std::chrono::microseconds>(end - start);
+  status.registered_at =
+      duration_cast<std::chrono::milliseconds>(end - sJniLoadedAt);
+  if (ret < 0) {
+    ALOGE("jni %s registration failure: %d", natives.name, ret);
+    status.state = PROFILE_NATIVES_FAILED;
+    return JNI_FALSE;
+  }
+
+  ALOGI("%s: %s registered in %lld us", __func__, natives.name,
+        (long long)status.register_time.count());
+  status.state = PROFILE_NATIVES_REGISTERED;
+  return JNI_TRUE;
+}
+
+static void dump_profile_natives(int fd) {
+  static const char* const kStateNames[] = {"unregistered", "registering",
+                                            "registered", "failed"};
+  std::lock_guard<std::recursive_mutex> lock(sProfileNativesMutex);
+  dprintf(fd, "\nProfile natives (registration time, time since load):\n");
+  for (size_t i = 0; i < NELEM(kProfileNatives); i++) {
+    const ProfileNativesStatus& status = sProfileNativesStatus[i];
+    if (status.state == PROFILE_NATIVES_UNREGISTERED) {
+      dprintf(fd, "  %-16s %s\n", kProfileNatives[i].name,
+              kStateNames[status.state]);
+      continue;
+    }
+    dprintf(fd, "  %-16s %-12s %6lld us %6lld ms\n", kProfileNatives[i].name,
+            kStateNames[status.state], (long long)status.register_time.count(),
+            (long long)status.registered_at.count());
+  }
+}
+
 static void dumpNative(JNIEnv* env, jobject obj, jobject fdObj,
                        jobjectArray argArray) {
   ALOGV("%s", __func__);
@@ -1168,6 +2121,15 @@ static void dumpNative(JNIEnv* env, jobject obj, jobject fdObj,
   }
 
   sBluetoothInterface->dump(fd, args);
+  dump_advertising_metrics(fd);
+  dump_wake_locks(fd);
+  dump_jni_attach_stats(fd);
+  dump_energy_samples(fd);
+  dump_state_journal(fd);
+  sRemoteProps.dump(fd);
+  dump_profile_natives(fd);
+  dump_jni_binding_times(fd);
+  android::bluetooth::dumpPermissionCache(fd);
 
   for (int i = 0; i < numArgs; i++) {
     env->ReleaseStringUTFChars(argObjs[i], args[i]);
@@ -1177,6 +2139,119 @@ static void dumpNative(JNIEnv* env, jobject obj, jobject fdObj,
   delete[] argObjs;
 }
 
+// Record: name (32 bytes), refs i32, held u8, acquires, java_acquires,
+// total_held_ms and max_held_ms u64.
+static bool dump_wake_locks_binary(int fd) {
+  std::lock_guard<std::mutex> lock(sWakeLockMutex);
+  DumpSectionWriter writer(fd, BT_DUMP_SECTION_WAKE_LOCKS, 32 + 4 + 1 + 4 * 8,
+                           sWakeLocks.size());
+  for (const auto& entry : sWakeLocks) {
+    const WakeLockState& state = entry.second;
+    writer.putString(entry.first.c_str(), 32);
+    writer.put<int32_t>(state.refs);
+    writer.put<uint8_t>(state.held);
+    writer.put<uint64_t>(state.acquires);
+    writer.put<uint64_t>(state.java_acquires);
+    writer.put<uint64_t>(state.total_held.count());
+    writer.put<uint64_t>(state.max_held.count());
+  }
+  return writer.finish();
+}
+
+// Record: timestamp_ms u64, ctrl_state u8, tx, rx and idle time and energy
+// used u64, uid count u8, then uid i32, rx and tx bytes u64 for each of the
+// kEnergySampleMaxUids slots.
+static bool dump_energy_binary(int fd) {
+  std::lock_guard<std::mutex> lock(sEnergyMutex);
+  DumpSectionWriter writer(fd, BT_DUMP_SECTION_ENERGY,
+                           8 + 1 + 4 * 8 + 1 + kEnergySampleMaxUids * 20,
+                           sEnergyRingCount);
+  size_t first =
+      (sEnergyRingNext + kEnergyRingSize - sEnergyRingCount) % kEnergyRingSize;
+  for (size_t n = 0; n < sEnergyRingCount; n++) {
+    const EnergySample& sample = sEnergyRing[(first + n) % kEnergyRingSize];
+    writer.put<uint64_t>(sample.timestamp_ms);
+    writer.put<uint8_t>(sample.ctrl_state);
+    writer.put<uint64_t>(sample.tx_time);
+    writer.put<uint64_t>(sample.rx_time);
+    writer.put<uint64_t>(sample.idle_time);
+    writer.put<uint64_t>(sample.energy_used);
+    writer.put<uint8_t>(sample.num_uids);
+    for (size_t i = 0; i < kEnergySampleMaxUids; i++) {
+      bool used = i < sample.num_uids;
+      writer.put<int32_t>(used ? sample.uids[i].uid : 0);
+      writer.put<uint64_t>(used ? sample.uids[i].rx_bytes : 0);
+      writer.put<uint64_t>(used ? sample.uids[i].tx_bytes : 0);
+    }
+  }
+  return writer.finish();
+}
+
+// Record: callout thread attaches u64.
+static bool dump_jni_binary(int fd) {
+  DumpSectionWriter writer(fd, BT_DUMP_SECTION_JNI, 8, 1);
+  writer.put<uint64_t>(sJniAttachCount.load());
+  return writer.finish();
+}
+
+// Record: timestamp_ns u64, address_id u32, event, status and state u8.
+static bool dump_state_journal_binary(int fd) {
+  std::vector<JournalEntry> entries = journal_snapshot();
+  DumpSectionWriter writer(fd, BT_DUMP_SECTION_JOURNAL, 8 + 4 + 3,
+                           entries.size());
+  for (const JournalEntry& entry : entries) {
+    writer.put<uint64_t>(entry.timestamp_ns);
+    writer.put<uint32_t>(entry.address_id);
+    writer.put<uint8_t>(entry.event);
+    writer.put<uint8_t>(entry.status);
+    writer.put<uint8_t>(entry.state);
+  }
+  return writer.finish();
+}
+
+/* Streams the selected sections (bit 1 << BtDumpSection, all if 0) to |fd|
+ * in the binary dump format, without building the output in memory. Stops at
+ * the first section that cannot be written. */
+static void dumpBinaryNative(JNIEnv* env, jobject obj, jobject fdObj,
+                             jint sections) {
+  ALOGV("%s", __func__);
+  int fd = jniGetFDFromFileDescriptor(env, fdObj);
+  if (fd < 0) return;
+
+  auto selected = [sections](BtDumpSection section) {
+    return sections == 0 || (sections & (1 << section));
+  };
+
+  uint8_t header[6];
+  uint32_t magic = BT_DUMP_MAGIC;
+  for (int i = 0; i < 4; i++) header[i] = magic >> (8 * i);
+  header[4] = BT_DUMP_VERSION;
+  header[5] = 0;
+  if (write(fd, header, sizeof(header)) != sizeof(header)) {
+    ALOGE("%s: unable to write dump header: %s", __func__, strerror(errno));
+    return;
+  }
+
+  static const struct {
+    BtDumpSection section;
+    bool (*dump)(int fd);
+  } kSections[] = {
+      {BT_DUMP_SECTION_ADV_METRICS, dump_advertising_metrics_binary},
+      {BT_DUMP_SECTION_WAKE_LOCKS, dump_wake_locks_binary},
+      {BT_DUMP_SECTION_ENERGY, dump_energy_binary},
+      {BT_DUMP_SECTION_JNI, dump_jni_binary},
+      {BT_DUMP_SECTION_JOURNAL, dump_state_journal_binary},
+  };
+  for (const auto& entry : kSections) {
+    if (!selected(entry.section)) continue;
+    if (!entry.dump(fd)) {
+      ALOGE("%s: unable to write dump section %d: %s", __func__,
+            entry.section, strerror(errno));
+      return;
+    }
+  }
+}
+
 static jbyteArray dumpMetricsNative(JNIEnv* env, jobject obj) {
   ALOGI("%s", __func__);
   if (!sBluetoothInterface) return env->NewByteArray(0);
@@ -1193,14 +2268,20 @@ static jbyteArray dumpMetricsNative(JNIEnv* env, jobject obj) {
 static jboolean factoryResetNative(JNIEnv* env, jobject obj) {
   ALOGV("%s", __func__);
   if (!sBluetoothInterface) return JNI_FALSE;
+  // Held across config_clear() so that no address is obfuscated, and
+  // remembered, with the secret that is being cleared.
+  std::lock_guard<std::mutex> lock(sObfuscatedMutex);
+  obfuscated_clear_locked(env);
   int ret = sBluetoothInterface->config_clear();
   return (ret == BT_STATUS_SUCCESS) ? JNI_TRUE : JNI_FALSE;
 }
 
+static void interop_clear();
+
 static void interopDatabaseClearNative(JNIEnv* env, jobject obj) {
   ALOGV("%s", __func__);
   if (!sBluetoothInterface) return;
-  sBluetoothInterface->interop_database_clear();
+  interop_clear();
 }
 
 static void interopDatabaseAddNative(JNIEnv* env, jobject obj, int feature,
@@ -1218,6 +2299,181 @@ static void interopDatabaseAddNative(JNIEnv* env, jobject obj, int feature,
   env->ReleaseByteArrayElements(address, addr, 0);
 }
 
+/* Compiled interop table. All integers are little endian.
+ *
+ * Header, 12 bytes:
+ *   bytes 0-3   magic, INTEROP_TABLE_MAGIC
+ *   bytes 4-5   version, INTEROP_TABLE_VERSION
+ *   bytes 6-7   reserved, written as zero and ignored on load
+ *   bytes 8-11  entry count
+ *
+ * Entry, 10 bytes, repeated count times:
+ *   bytes 0-1   interop feature
+ *   byte  2     address prefix length, 1 to 6
+ *   byte  3     reserved, written as zero and ignored on load
+ *   bytes 4-9   address, only the first |length| bytes are matched
+ *
+ * The entries from Settings.Global are handed over in the same entry
+ * format, without a header. */
+#define INTEROP_TABLE_MAGIC 0x4f495442 /* "BTIO" */
+#define INTEROP_TABLE_VERSION 1
+static constexpr size_t kInteropHeaderLen = 4 + 2 + 2 + 4;
+static constexpr size_t kInteropEntryLen = 2 + 1 + 1 + 6;
+
+struct InteropEntry {
+  uint16_t feature;
+  uint8_t length;
+  RawAddress address;
+
+  bool operator<(const InteropEntry& other) const {
+    return std::tie(feature, length, address) <
+           std::tie(other.feature, other.length, other.address);
+  }
+};
+
+// Serializes loads, so a reload never interleaves with another one.
+static std::mutex sInteropMutex;
+// Entries added to the stack's database since it was last cleared.
+static std::set<InteropEntry> sInteropApplied;
+
+static void interop_clear() {
+  std::lock_guard<std::mutex> lock(sInteropMutex);
+  sBluetoothInterface->interop_database_clear();
+  sInteropApplied.clear();
+}
+
+static uint32_t interop_read_le(const uint8_t* p, size_t len) {
+  uint32_t value = 0;
+  for (size_t i = 0; i < len; i++) value |= (uint32_t)p[i] << (8 * i);
+  return value;
+}
+
+/* Appends |count| entries at |data| to |entries|. Returns false, leaving
+ * |entries| as it was, unless every entry is well formed. */
+static bool interop_parse_entries(const uint8_t* data, size_t count,
+                                  std::vector<InteropEntry>* entries) {
+  size_t first = entries->size();
+  entries->resize(first + count);
+  const uint8_t* p = data;
+  for (size_t i = 0; i < count; i++, p += kInteropEntryLen) {
+    InteropEntry& entry = (*entries)[first + i];
+    entry.feature = interop_read_le(p, 2);
+    entry.length = p[2];
+    if (entry.length < 1 || entry.length > sizeof(RawAddress)) {
+      entries->resize(first);
+      return false;
+    }
+    memcpy(entry.address.address, p + 4, sizeof(RawAddress));
+  }
+  return true;
+}
+
+/* Parses a mapped interop table into |entries|. Returns false, leaving
+ * |entries| as it was, unless the whole table is well formed. */
+static bool interop_parse_table(const uint8_t* data, size_t size,
+                                std::vector<InteropEntry>* entries) {
+  if (size < kInteropHeaderLen) return false;
+  if (interop_read_le(data, 4) != INTEROP_TABLE_MAGIC ||
+      interop_read_le(data + 4, 2) != INTEROP_TABLE_VERSION) {
+    return false;
+  }
+  size_t count = interop_read_le(data + 8, 4);
+  if (count > (size - kInteropHeaderLen) / kInteropEntryLen ||
+      size != kInteropHeaderLen + count * kInteropEntryLen) {
+    return false;
+  }
+
+  return interop_parse_entries(data + kInteropHeaderLen, count, entries);
+}
+
+/* Reads the table at |path| into |entries|. A missing file is an empty
+ * table. */
+static bool interop_read_table(const char* path,
+                               std::vector<InteropEntry>* entries) {
+  int fd = TEMP_FAILURE_RETRY(open(path, O_RDONLY | O_CLOEXEC));
+  if (fd < 0) {
+    if (errno == ENOENT) return true;
+    ALOGE("%s: unable to open table: %s", __func__, strerror(errno));
+    return false;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) < 0 || st.st_size <= 0) {
+    ALOGE("%s: empty or unreadable table", __func__);
+    close(fd);
+    return false;
+  }
+  void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    ALOGE("%s: unable to map table: %s", __func__, strerror(errno));
+    return false;
+  }
+
+  bool valid = interop_parse_table((const uint8_t*)data, st.st_size, entries);
+  munmap(data, st.st_size);
+  if (!valid) ALOGE("%s: malformed table", __func__);
+  return valid;
+}
+
+/* Loads the table at |path| followed by the packed |extra| entries into the
+ * interop database. The new table is read, mapped and validated in full
+ * before the database is touched; on any error the database is left as it
+ * was. A missing file contributes no entries.
+ *
+ * The stack looks entries up without a lock this side can take, and only
+ * offers clear and add. Clearing would leave lookups an empty or partial
+ * database until the adds finish, so the new table is swapped in by adding
+ * only the entries the database does not have yet. Each lookup then sees the
+ * old table or the old table plus some new entries, never less. Entries left
+ * out of the new table stay in effect until the stack restarts with an empty
+ * database. Returns the number of entries in the new table, or -1 on
+ * error. */
+static jint interopDatabaseLoadNative(JNIEnv* env, jobject obj, jstring path,
+                                      jbyteArray extra) {
+  ALOGV("%s", __func__);
+  if (!sBluetoothInterface) return -1;
+
+  std::vector<InteropEntry> entries;
+  const char* c_path = env->GetStringUTFChars(path, NULL);
+  if (c_path == NULL) return -1;
+  bool valid = interop_read_table(c_path, &entries);
+  env->ReleaseStringUTFChars(path, c_path);
+  if (!valid) return -1;
+
+  if (extra != NULL) {
+    size_t extra_len = env->GetArrayLength(extra);
+    if (extra_len % kInteropEntryLen != 0) {
+      ALOGE("%s: malformed extra entries", __func__);
+      return -1;
+    }
+    jbyte* data = env->GetByteArrayElements(extra, NULL);
+    if (data == NULL) return -1;
+    valid = interop_parse_entries((const uint8_t*)data,
+                                  extra_len / kInteropEntryLen, &entries);
+    env->ReleaseByteArrayElements(extra, data, JNI_ABORT);
+    if (!valid) {
+      ALOGE("%s: malformed extra entries", __func__);
+      return -1;
+    }
+  }
+
+  std::set<InteropEntry> table(entries.begin(), entries.end());
+  std::lock_guard<std::mutex> lock(sInteropMutex);
+  size_t added = 0;
+  for (const InteropEntry& entry : table) {
+    if (!sInteropApplied.insert(entry).second) continue;
+    RawAddress address = entry.address;
+    sBluetoothInterface->interop_database_add(entry.feature, &address,
+                                              entry.length);
+    added++;
+  }
+  size_t stale = sInteropApplied.size() - table.size();
+  ALOGI("%s: %zu entries, %zu added, %zu removed until restart", __func__,
+        table.size(), added, stale);
+  return table.size();
+}
+
 static jbyteArray obfuscateAddressNative(JNIEnv* env, jobject obj,
                                          jbyteArray address) {
   ALOGV("%s", __func__);
@@ -1229,17 +2485,43 @@ static jbyteArray obfuscateAddressNative(JNIEnv* env, jobject obj,
   }
   RawAddress addr_obj = {};
   addr_obj.FromOctets((uint8_t*)addr);
+  env->ReleaseByteArrayElements(address, addr, JNI_ABORT);
+
+  std::lock_guard<std::mutex> lock(sObfuscatedMutex);
+  auto it = sObfuscated.find(addr_obj);
+  if (it != sObfuscated.end()) {
+    sObfuscatedLru.splice(sObfuscatedLru.begin(), sObfuscatedLru,
+                          it->second.lru);
+    return (jbyteArray)env->NewLocalRef(it->second.bytes);
+  }
+
   std::string output = sBluetoothInterface->obfuscate_address(addr_obj);
   jsize output_size = output.size() * sizeof(char);
   jbyteArray output_bytes = env->NewByteArray(output_size);
+  if (output_bytes == nullptr) return nullptr;
   env->SetByteArrayRegion(output_bytes, 0, output_size,
                           (const jbyte*)output.data());
+
+  // A failed obfuscation is empty; leave it for the next call to retry.
+  if (output_size == 0) return output_bytes;
+  jbyteArray global = (jbyteArray)env->NewGlobalRef(output_bytes);
+  if (global == nullptr) return output_bytes;
+  if (sObfuscated.size() >= kObfuscatedMax) {
+    auto oldest = sObfuscated.find(sObfuscatedLru.back());
+    env->DeleteGlobalRef(oldest->second.bytes);
+    sObfuscated.erase(oldest);
+    sObfuscatedLru.pop_back();
+  }
+  sObfuscatedLru.push_front(addr_obj);
+  sObfuscated[addr_obj] = {global, sObfuscatedLru.begin()};
   return output_bytes;
 }
 
 static JNINativeMethod sMethods[] = {
     /* name, signature, funcPtr */
     {"classInitNative", "()V", (void*)classInitNative},
+    {"registerProfileNativesNative", "(Ljava/lang/String;)Z",
+     (void*)registerProfileNativesNative},
     {"initNative", "(ZZ)Z", (void*)initNative},
     {"cleanupNative", "()V", (void*)cleanupNative},
     {"enableNative", "()Z", (void*)enableNative},
@@ -1260,18 +2542,26 @@ static JNINativeMethod sMethods[] = {
     {"pinReplyNative", "([BZI[B)Z", (void*)pinReplyNative},
     {"sspReplyNative", "([BIZI)Z", (void*)sspReplyNative},
     {"getRemoteServicesNative", "([B)Z", (void*)getRemoteServicesNative},
+    {"refreshRemoteDevicePropertiesNative", "([B)V",
+     (void*)refreshRemoteDevicePropertiesNative},
     {"getSocketManagerNative", "()Landroid/os/IBinder;",
      (void*)getSocketManagerNative},
     {"setSystemUiUidNative", "(I)V", (void*)setSystemUiUidNative},
     {"setForegroundUserIdNative", "(I)V", (void*)setForegroundUserIdNative},
     {"alarmFiredNative", "()V", (void*)alarmFiredNative},
     {"readEnergyInfo", "()I", (void*)readEnergyInfo},
+    {"setEnergySamplingIntervalNative", "(I)V",
+     (void*)setEnergySamplingIntervalNative},
     {"dumpNative", "(Ljava/io/FileDescriptor;[Ljava/lang/String;)V",
      (void*)dumpNative},
     {"dumpMetricsNative", "()[B", (void*)dumpMetricsNative},
+    {"dumpBinaryNative", "(Ljava/io/FileDescriptor;I)V",
+     (void*)dumpBinaryNative},
     {"factoryResetNative", "()Z", (void*)factoryResetNative},
     {"interopDatabaseClearNative", "()V", (void*)interopDatabaseClearNative},
     {"interopDatabaseAddNative", "(I[BI)V", (void*)interopDatabaseAddNative},
+    {"interopDatabaseLoadNative", "(Ljava/lang/String;[B)I",
+     (void*)interopDatabaseLoadNative},
     {"obfuscateAddressNative", "([B)[B", (void*)obfuscateAddressNative}};
 
 int register_com_android_bluetooth_btservice_AdapterService(JNIEnv* env) {
@@ -1290,6 +2580,7 @@ jint JNI_OnLoad(JavaVM* jvm, void* reserved) {
   int status;
 
   ALOGV("Bluetooth Adapter Service : loading JNI\n");
+  android::sJniLoadedAt = std::chrono::steady_clock::now();
 
   // Check JNI version
   if (jvm->GetEnv((void**)&e, JNI_VERSION_1_6)) {
@@ -1297,87 +2588,12 @@ jint JNI_OnLoad(JavaVM* jvm, void* reserved) {
     return JNI_ERR;
   }
 
+  // Profile natives are registered when their classes are first loaded, see
+  // registerProfileNativesNative().
   status = android::register_com_android_bluetooth_btservice_AdapterService(e);
   if (status < 0) {
     ALOGE("jni adapter service registration failure, status: %d", status);
     return JNI_ERR;
   }
-
-  status = android::register_com_android_bluetooth_hfp(e);
-  if (status < 0) {
-    ALOGE("jni hfp registration failure, status: %d", status);
-    return JNI_ERR;
-  }
-
-  status = android::register_com_android_bluetooth_hfpclient(e);
-  if (status < 0) {
-    ALOGE("jni hfp client registration failure, status: %d", status);
-    return JNI_ERR;
-  }
-
-  status = android::register_com_android_bluetooth_a2dp(e);
-  if (status < 0) {
-    ALOGE("jni a2dp source registration failure: %d", status);
-    return JNI_ERR;
-  }
-
-  status = android::register_com_android_bluetooth_a2dp_sink(e);
-  if (status < 0) {
-    ALOGE("jni a2dp sink registration failure: %d", status);
-    return JNI_ERR;
-  }
-
-  status = android::register_com_android_bluetooth_avrcp_target(e);
-  if (status < 0) {
-    ALOGE("jni new avrcp target registration failure: %d", status);
-  }
-
-  status = android::register_com_android_bluetooth_avrcp_controller(e);
-  if (status < 0) {
-    ALOGE("jni avrcp controller registration failure: %d", status);
-    return JNI_ERR;
-  }
-
-  status = android::register_com_android_bluetooth_hid_host(e);
-  if (status < 0) {
-    ALOGE("jni hid registration failure: %d", status);
-    return JNI_ERR;
-  }
-
-  status = android::register_com_android_bluetooth_hid_device(e);
-  if (status < 0) {
-    ALOGE("jni hidd registration failure: %d", status);
-    return JNI_ERR;
-  }
-
-  status = android::register_com_android_bluetooth_pan(e);
-  if (status < 0) {
-    ALOGE("jni pan registration failure: %d", status);
-    return JNI_ERR;
-  }
-
-  status = android::register_com_android_bluetooth_gatt(e);
-  if (status < 0) {
-    ALOGE("jni gatt registration failure: %d", status);
-    return JNI_ERR;
-  }
-
-  status = android::register_com_android_bluetooth_sdp(e);
-  if (status < 0) {
-    ALOGE("jni sdp registration failure: %d", status);
-    return JNI_ERR;
-  }
-
-  status = android::register_com_android_bluetooth_hearing_aid(e);
-  if (status < 0) {
-    ALOGE("jni hearing aid registration failure: %d", status);
-    return JNI_ERR;
-  }
-
-  status = android::register_com_android_bluetooth_btservice_vendor_socket(e);
-  if (status < 0) {
-    ALOGE("jni vendor socket registration failure: %d", status);
-    return JNI_ERR;
-  }
   return JNI_VERSION_1_6;
 }
@@ -0,0 +1,106 @@
+/*
+ * Copyright 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <base/macros.h>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+namespace android {
+
+/* Binary dump of AdapterService.dumpBinaryNative: a stream header followed by
+ * sections. Each section starts with its id, the size of one record and the
+ * number of records, then the records themselves. All integers are little
+ * endian. */
+enum BtDumpSection : uint16_t {
+  BT_DUMP_SECTION_ADV_METRICS = 1,
+  BT_DUMP_SECTION_WAKE_LOCKS = 2,
+  BT_DUMP_SECTION_ENERGY = 3,
+  BT_DUMP_SECTION_JNI = 4,
+  BT_DUMP_SECTION_JOURNAL = 5,
+};
+
+#define BT_DUMP_MAGIC 0x444a5442 /* "BTJD" */
+#define BT_DUMP_VERSION 1
+
+// Writes one section straight to the dump fd through a small stack buffer.
+// After the first failed write the rest of the section is dropped, and
+// finish() reports the failure.
+class DumpSectionWriter {
+ public:
+  DumpSectionWriter(int fd, BtDumpSection section, uint16_t record_len,
+                    uint32_t record_count)
+      : fd_(fd) {
+    put<uint16_t>(section);
+    put<uint16_t>(record_len);
+    put<uint32_t>(record_count);
+  }
+
+  ~DumpSectionWriter() { flush(); }
+
+  template <typename T>
+  void put(T value) {
+    if (used_ + sizeof(T) > sizeof(buf_)) flush();
+    if (error_ != 0) return;
+    for (size_t i = 0; i < sizeof(T); i++) {
+      buf_[used_++] = (uint64_t)value >> (8 * i);
+    }
+  }
+
+  // Fixed-width string field, truncated or zero padded to |len| bytes.
+  void putString(const char* str, size_t len) {
+    size_t n = strnlen(str, len);
+    for (size_t i = 0; i < len; i++) put<uint8_t>(i < n ? str[i] : 0);
+  }
+
+  // Writes out what is buffered. Returns false, with errno set, if any part
+  // of the section could not be written.
+  bool finish() {
+    flush();
+    if (error_ == 0) return true;
+    errno = error_;
+    return false;
+  }
+
+ private:
+  void flush() {
+    size_t off = 0;
+    while (error_ == 0 && off < used_) {
+      ssize_t ret = write(fd_, buf_ + off, used_ - off);
+      if (ret < 0 && errno == EINTR) continue;
+      if (ret <= 0) {
+        error_ = ret < 0 ? errno : EIO;
+        break;
+      }
+      off += ret;
+    }
+    used_ = 0;
+  }
+
+  int fd_;
+  uint8_t buf_[512];
+  size_t used_ = 0;
+  int error_ = 0;
+
+  DISALLOW_COPY_AND_ASSIGN(DumpSectionWriter);
+};
+
+// Writes the advertising metrics section. Returns false on a write error.
+bool dump_advertising_metrics_binary(int fd);
+
+}  // namespace android
@@ -20,14 +20,24 @@
 
 #include "android_runtime/AndroidRuntime.h"
 #include "com_android_bluetooth.h"
+#include "com_android_bluetooth_dump.h"
 #include "hardware/bt_gatt.h"
 #include "utils/Log.h"
 
 #include <base/bind.h>
 #include <base/callback.h>
+#include <inttypes.h>
+#include <stdio.h>
 #include <string.h>
+#include <algorithm>
 #include <array>
+#include <chrono>
+#include <deque>
+#include <list>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <set>
 
 #include <cutils/log.h>
 #define info(fmt, ...) ALOGI("%s(L%d): " fmt, __func__, __LINE__, ##__VA_ARGS__)
@@ -178,6 +188,15 @@ static jmethodID method_onPeriodicAdvertisingParametersUpdated;
 static jmethodID method_onPeriodicAdvertisingDataSet;
 static jmethodID method_onPeriodicAdvertisingEnabled;
 
+/**
+ * Periodic advertising parameter getters, resolved once in
+ * advertiseClassInitNative
+ */
+static struct {
+  jmethodID getIncludeTxPower;
+  jmethodID getInterval;
+} android_bluetooth_le_PeriodicAdvParams;
+
 /**
  * Periodic scanner callback methods
  */
@@ -557,6 +576,439 @@ static const btgatt_client_callbacks_t sGattClientCallbacks = {
     btgattc_phy_updated_cb,
     btgattc_conn_updated_cb};
 
+/**
+ * Server outbound notification queue
+ *
+ * Notifications and indications are queued per connection and pushed to the
+ * stack when the link is not congested. At most one indication is outstanding
+ * per connection, and a bounded window of notifications may be in flight.
+ * Connections are served round-robin so one busy link cannot starve others.
+ *
+ * Completions do not say what they complete, and a notification completes
+ * when it is handed to L2CAP while an indication waits for the peer. The two
+ * kinds are therefore never in flight together on a connection, so every
+ * completion belongs to the oldest value in flight.
+ *
+ * A notification sent latest-only replaces the value of a notification for
+ * the same handle that is still queued, instead of queueing behind it.
+ *
+ * A framed value is split to fit the connection MTU, each fragment prefixed
+ * with a two byte header:
+ *   byte 0: frame sequence number, incremented per framed value
+ *   byte 1: fragment index (bits 0-6), bit 7 set on the last fragment
+ * Only the completion of the last fragment is reported, with the first
+ * failure of any fragment.
+ */
+struct PendingNotification {
+  int server_if;
+  int attr_handle;
+  bool confirm;
+  std::vector<uint8_t> value;
+  // False for all but the last fragment of a framed value.
+  bool report = true;
+};
+
+struct InFlightNotification {
+  bool confirm;
+  bool report;
+};
+
+// Default ATT MTU until the peer negotiates a larger one.
+static constexpr int kAttDefaultMtu = 23;
+// Opcode and attribute handle of a Handle Value Notification/Indication.
+static constexpr int kAttNotificationHeaderLen = 3;
+
+struct ServerConnQueue {
+  RawAddress bda;
+  std::deque<PendingNotification> pending;
+  bool congested = false;
+  // Values handed to the stack, oldest first.
+  std::deque<InFlightNotification> in_flight;
+  int mtu = kAttDefaultMtu;
+  uint8_t frame_seq = 0;
+  // First failure among the fragments of the framed value being completed.
+  int frame_status = 0;
+  // Client Characteristic Configuration value per characteristic handle.
+  std::map<int, uint8_t> subscriptions;
+  // CCCD values awaiting a successful response, per trans_id.
+  std::map<int, std::map<int, uint8_t>> cccd_pending;
+  // Prepared CCCD writes awaiting execute, per CCCD handle.
+  std::map<int, std::vector<uint8_t>> cccd_prepared;
+};
+
+static constexpr size_t kServerQueueMaxDepth = 64;
+static constexpr size_t kServerQueueNotificationWindow = 8;
+
+static constexpr int kFrameHeaderLen = 2;
+static constexpr uint8_t kFrameLastFragment = 0x80;
+static_assert(kServerQueueMaxDepth <= kFrameLastFragment,
+              "fragment index must fit in seven bits");
+
+// Statuses returned when a notification cannot be queued (stack gatt_api.h).
+static constexpr int kGattSuccess = 0x00;
+static constexpr int kGattNoResources = 0x80;
+static constexpr int kGattError = 0x85;
+static constexpr int kGattCccCfgErr = 0xFD;
+// Returned when a latest-only value replaced a queued one, which is then done
+// without being sent. Not a GATT status.
+static constexpr int kServerQueueReplaced = -1;
+
+// Serializes hand-off to the stack so notifications leave in queue order.
+// Always acquired before sServerQueueMutex, which is never held across stack
+// calls.
+static std::mutex sServerSendMutex;
+static std::mutex sServerQueueMutex;
+static std::map<int, ServerConnQueue> sServerQueues;
+static int sServerQueueCursor = 0;
+
+struct ServerSend {
+  int conn_id;
+  PendingNotification item;
+};
+
+static bool server_queue_can_send(const ServerConnQueue& queue) {
+  if (queue.pending.empty() || queue.congested) return false;
+
+  bool confirm = queue.pending.front().confirm;
+  if (queue.in_flight.empty()) return true;
+  if (queue.in_flight.front().confirm != confirm) return false;
+  return !confirm && queue.in_flight.size() < kServerQueueNotificationWindow;
+}
+
+// Must be called with sServerQueueMutex held. Returns the notifications that
+// were taken off the queues, to be handed to the stack after unlocking.
+static std::vector<ServerSend> server_queue_dispatch_locked() {
+  std::vector<ServerSend> batch;
+  if (!sGattIf || sServerQueues.empty()) return batch;
+
+  bool sent;
+  do {
+    sent = false;
+    // Start after the connection served last, then wrap around.
+    auto start = sServerQueues.upper_bound(sServerQueueCursor);
+    for (size_t n = 0; n < sServerQueues.size(); n++, start++) {
+      if (start == sServerQueues.end()) start = sServerQueues.begin();
+
+      ServerConnQueue& queue = start->second;
+      if (!server_queue_can_send(queue)) continue;
+
+      PendingNotification item = std::move(queue.pending.front());
+      queue.pending.pop_front();
+      queue.in_flight.push_back({item.confirm, item.report});
+
+      sServerQueueCursor = start->first;
+      batch.push_back({start->first, std::move(item)});
+      sent = true;
+    }
+  } while (sent);
+  return batch;
+}
+
+// Must be called with sServerQueueMutex held. Queues all fragments of a framed
+// value, or none of them if they do not fit.
+static bool server_queue_push_framed_locked(ServerConnQueue* queue,
+                                            int server_if, int attr_handle,
+                                            bool confirm,
+                                            const std::vector<uint8_t>& value) {
+  size_t chunk_len = queue->mtu - kAttNotificationHeaderLen - kFrameHeaderLen;
+  size_t fragments =
+      value.empty() ? 1 : (value.size() + chunk_len - 1) / chunk_len;
+  if (queue->pending.size() + fragments > kServerQueueMaxDepth) return false;
+
+  uint8_t seq = queue->frame_seq++;
+  for (size_t i = 0; i < fragments; i++) {
+    size_t offset = i * chunk_len;
+    size_t len = std::min(chunk_len, value.size() - offset);
+    bool last = i == fragments - 1;
+
+    std::vector<uint8_t> fragment;
+    fragment.reserve(kFrameHeaderLen + len);
+    fragment.push_back(seq);
+    fragment.push_back(i | (last ? kFrameLastFragment : 0));
+    fragment.insert(fragment.end(), value.begin() + offset,
+                    value.begin() + offset + len);
+
+    queue->pending.push_back(
+        {server_if, attr_handle, confirm, std::move(fragment), last});
+  }
+  return true;
+}
+
+// Must be called with sServerSendMutex held.
+static void server_queue_send(std::vector<ServerSend> batch) {
+  if (!sGattIf) return;
+
+  for (ServerSend& send : batch) {
+    sGattIf->server->send_indication(send.item.server_if,
+                                     send.item.attr_handle, send.conn_id,
+                                     send.item.confirm,
+                                     std::move(send.item.value));
+  }
+}
+
+// Returns false if the completion is for a fragment that is not reported.
+// Otherwise |status| is updated with the failure of an earlier fragment.
+static bool server_queue_on_sent(int conn_id, int* status) {
+  std::lock_guard<std::mutex> send_lock(sServerSendMutex);
+  std::vector<ServerSend> batch;
+  bool report = true;
+  {
+    std::lock_guard<std::mutex> lock(sServerQueueMutex);
+    auto it = sServerQueues.find(conn_id);
+    if (it == sServerQueues.end()) return true;
+
+    ServerConnQueue& queue = it->second;
+    if (!queue.in_flight.empty()) {
+      report = queue.in_flight.front().report;
+      queue.in_flight.pop_front();
+    }
+    if (queue.frame_status == 0) queue.frame_status = *status;
+    if (report) {
+      *status = queue.frame_status;
+      queue.frame_status = 0;
+    }
+    batch = server_queue_dispatch_locked();
+  }
+  server_queue_send(std::move(batch));
+  return report;
+}
+
+static void server_queue_on_mtu_changed(int conn_id, int mtu) {
+  std::lock_guard<std::mutex> lock(sServerQueueMutex);
+  auto it = sServerQueues.find(conn_id);
+  if (it == sServerQueues.end()) return;
+
+  it->second.mtu = std::max(mtu, kAttDefaultMtu);
+}
+
+static void server_queue_on_congestion(int conn_id, bool congested) {
+  std::lock_guard<std::mutex> send_lock(sServerSendMutex);
+  std::vector<ServerSend> batch;
+  {
+    std::lock_guard<std::mutex> lock(sServerQueueMutex);
+    auto it = sServerQueues.find(conn_id);
+    if (it == sServerQueues.end()) return;
+
+    it->second.congested = congested;
+    if (!congested) batch = server_queue_dispatch_locked();
+  }
+  server_queue_send(std::move(batch));
+}
+
+/**
+ * CCCD subscription tracking
+ *
+ * CCCD handles are learnt from the services this process adds. A write to one
+ * is recorded for the connection once the app has accepted it with a
+ * successful response, including prepared writes accepted through an execute
+ * write. Sends to a characteristic with a CCCD are skipped for connections
+ * that have not enabled them.
+ *
+ * A bonded peer does not rewrite its CCCD on reconnection, so the values of a
+ * peer are retained when it disconnects, and restored if it reconnects while
+ * bonded. They are dropped if it reconnects without a bond.
+ */
+static constexpr uint16_t kCccdUuid16 = 0x2902;
+static constexpr size_t kCccdLen = 2;
+static constexpr uint8_t kCccdNotify = 0x01;
+static constexpr uint8_t kCccdIndicate = 0x02;
+
+// CCCD handle -> characteristic handle
+static std::map<int, int> sCccdCharHandles;
+// service handle -> CCCD handles in that service
+static std::map<int, std::vector<int>> sServiceCccds;
+// characteristic handles that have a CCCD
+static std::set<int> sCccdCharacteristics;
+
+// Subscriptions of disconnected peers, most recently disconnected first.
+static constexpr size_t kCccdRetainedMax = 32;
+static std::list<std::pair<RawAddress, std::map<int, uint8_t>>> sCccdRetained;
+
+// Must be called with sServerQueueMutex held.
+static std::map<int, uint8_t> server_cccd_take_retained_locked(
+    const RawAddress& bda) {
+  std::map<int, uint8_t> subscriptions;
+  for (auto it = sCccdRetained.begin(); it != sCccdRetained.end(); it++) {
+    if (it->first != bda) continue;
+
+    subscriptions = std::move(it->second);
+    sCccdRetained.erase(it);
+    break;
+  }
+  return subscriptions;
+}
+
+static void server_cccd_add_service(
+    const std::vector<btgatt_db_element_t>& service) {
+  std::lock_guard<std::mutex> lock(sServerQueueMutex);
+  const Uuid cccd_uuid = Uuid::From16Bit(kCccdUuid16);
+
+  int service_handle = 0;
+  int char_handle = 0;
+  for (const btgatt_db_element_t& el : service) {
+    switch (el.type) {
+      case BTGATT_DB_PRIMARY_SERVICE:
+      case BTGATT_DB_SECONDARY_SERVICE:
+        service_handle = el.attribute_handle;
+        char_handle = 0;
+        break;
+      case BTGATT_DB_CHARACTERISTIC:
+        char_handle = el.attribute_handle;
+        break;
+      case BTGATT_DB_DESCRIPTOR:
+        if (el.uuid == cccd_uuid && char_handle != 0) {
+          sCccdCharHandles[el.attribute_handle] = char_handle;
+          sCccdCharacteristics.insert(char_handle);
+          sServiceCccds[service_handle].push_back(el.attribute_handle);
+        }
+        break;
+      default:
+        break;
+    }
+  }
+}
+
+static void server_cccd_delete_service(int srvc_handle) {
+  std::lock_guard<std::mutex> lock(sServerQueueMutex);
+  auto it = sServiceCccds.find(srvc_handle);
+  if (it == sServiceCccds.end()) return;
+
+  for (int cccd_handle : it->second) {
+    int char_handle = sCccdCharHandles[cccd_handle];
+    sCccdCharHandles.erase(cccd_handle);
+    sCccdCharacteristics.erase(char_handle);
+    for (auto& entry : sServerQueues) {
+      entry.second.subscriptions.erase(char_handle);
+    }
+    for (auto& entry : sCccdRetained) entry.second.erase(char_handle);
+  }
+  sServiceCccds.erase(it);
+}
+
+static void server_cccd_on_write(int conn_id, int trans_id, int attr_handle,
+                                 int offset, bool need_rsp, bool is_prep,
+                                 const std::vector<uint8_t>& value) {
+  std::lock_guard<std::mutex> lock(sServerQueueMutex);
+  auto it = sCccdCharHandles.find(attr_handle);
+  if (it == sCccdCharHandles.end()) return;
+  auto conn = sServerQueues.find(conn_id);
+  if (conn == sServerQueues.end()) return;
+
+  ServerConnQueue& queue = conn->second;
+  if (is_prep) {
+    if (offset < 0 || offset + value.size() > kCccdLen) return;
+
+    std::vector<uint8_t>& prepared = queue.cccd_prepared[attr_handle];
+    if (prepared.size() < offset + value.size()) {
+      prepared.resize(offset + value.size());
+    }
+    std::copy(value.begin(), value.end(), prepared.begin() + offset);
+    return;
+  }
+
+  if (offset != 0 || value.size() != kCccdLen) return;
+
+  uint8_t cccd = value[0] & (kCccdNotify | kCccdIndicate);
+  if (need_rsp) {
+    queue.cccd_pending[trans_id][it->second] = cccd;
+  } else {
+    queue.subscriptions[it->second] = cccd;
+  }
+}
+
+static void server_cccd_on_exec_write(int conn_id, int trans_id,
+                                      bool exec_write) {
+  std::lock_guard<std::mutex> lock(sServerQueueMutex);
+  auto conn = sServerQueues.find(conn_id);
+  if (conn == sServerQueues.end()) return;
+
+  ServerConnQueue& queue = conn->second;
+  if (exec_write) {
+    for (const auto& entry : queue.cccd_prepared) {
+      auto it = sCccdCharHandles.find(entry.first);
+      if (it == sCccdCharHandles.end() || entry.second.size() != kCccdLen)
+        continue;
+      queue.cccd_pending[trans_id][it->second] =
+          entry.second[0] & (kCccdNotify | kCccdIndicate);
+    }
+  }
+  queue.cccd_prepared.clear();
+}
+
+static void server_cccd_on_response(int conn_id, int trans_id, int status) {
+  std::lock_guard<std::mutex> lock(sServerQueueMutex);
+  auto conn = sServerQueues.find(conn_id);
+  if (conn == sServerQueues.end()) return;
+
+  ServerConnQueue& queue = conn->second;
+  auto pending = queue.cccd_pending.find(trans_id);
+  if (pending == queue.cccd_pending.end()) return;
+
+  if (status == kGattSuccess) {
+    for (const auto& entry : pending->second) {
+      if (sCccdCharacteristics.count(entry.first) == 0) continue;
+      queue.subscriptions[entry.first] = entry.second;
+    }
+  }
+  queue.cccd_pending.erase(pending);
+}
+
+// Must be called with sServerQueueMutex held.
+static bool server_cccd_is_subscribed_locked(int conn_id, int attr_handle,
+                                             bool confirm) {
+  if (sCccdCharacteristics.count(attr_handle) == 0) return true;
+
+  auto conn = sServerQueues.find(conn_id);
+  if (conn == sServerQueues.end()) return false;
+  auto sub = conn->second.subscriptions.find(attr_handle);
+  if (sub == conn->second.subscriptions.end()) return false;
+
+  return sub->second & (confirm ? kCccdIndicate : kCccdNotify);
+}
+
+static void server_cccd_restore(int conn_id, bool bonded) {
+  std::lock_guard<std::mutex> lock(sServerQueueMutex);
+  auto conn = sServerQueues.find(conn_id);
+  if (conn == sServerQueues.end()) return;
+
+  std::map<int, uint8_t> retained =
+      server_cccd_take_retained_locked(conn->second.bda);
+  if (!bonded) return;
+
+  for (const auto& entry : retained) {
+    conn->second.subscriptions.emplace(entry.first, entry.second);
+  }
+}
+
+static void server_queue_add(int conn_id, const RawAddress& bda) {
+  std::lock_guard<std::mutex> lock(sServerQueueMutex);
+  sServerQueues.emplace(conn_id, ServerConnQueue()).first->second.bda = bda;
+}
+
+static void server_queue_remove(int conn_id) {
+  std::lock_guard<std::mutex> lock(sServerQueueMutex);
+  auto conn = sServerQueues.find(conn_id);
+  if (conn == sServerQueues.end()) return;
+
+  const RawAddress& bda = conn->second.bda;
+  server_cccd_take_retained_locked(bda);
+  if (!conn->second.subscriptions.empty()) {
+    sCccdRetained.emplace_front(bda, std::move(conn->second.subscriptions));
+    if (sCccdRetained.size() > kCccdRetainedMax) sCccdRetained.pop_back();
+  }
+  sServerQueues.erase(conn);
+}
+
+static void server_queue_clear() {
+  std::lock_guard<std::mutex> lock(sServerQueueMutex);
+  sServerQueues.clear();
+  sServerQueueCursor = 0;
+  sCccdCharHandles.clear();
+  sServiceCccds.clear();
+  sCccdCharacteristics.clear();
+  sCccdRetained.clear();
+}
+
 /**
  * BTA server callbacks
  */
@@ -570,6 +1022,12 @@ void btgatts_register_app_cb(int status, int server_if, const Uuid& uuid) {
 
 void btgatts_connection_cb(int conn_id, int server_if, int connected,
                            const RawAddress& bda) {
+  if (connected) {
+    server_queue_add(conn_id, bda);
+  } else {
+    server_queue_remove(conn_id);
+  }
+
   CallbackEnv sCallbackEnv(__func__);
   if (!sCallbackEnv.valid()) return;
 
@@ -581,6 +1039,8 @@ void btgatts_connection_cb(int conn_id, int server_if, int connected,
 
 void btgatts_service_added_cb(int status, int server_if,
                               std::vector<btgatt_db_element_t> service) {
+  if (status == 0) server_cccd_add_service(service);
+
   CallbackEnv sCallbackEnv(__func__);
   if (!sCallbackEnv.valid()) return;
 
@@ -606,6 +1066,8 @@ void btgatts_service_stopped_cb(int status, int server_if, int srvc_handle) {
 }
 
 void btgatts_service_deleted_cb(int status, int server_if, int srvc_handle) {
+  if (status == 0) server_cccd_delete_service(srvc_handle);
+
   CallbackEnv sCallbackEnv(__func__);
   if (!sCallbackEnv.valid()) return;
   sCallbackEnv->CallVoidMethod(mCallbacksObj, method_onServiceDeleted, status,
@@ -665,6 +1127,9 @@ void btgatts_request_write_descriptor_cb(int conn_id, int trans_id,
                                          int offset, bool need_rsp,
                                          bool is_prep,
                                          std::vector<uint8_t> value) {
+  server_cccd_on_write(conn_id, trans_id, attr_handle, offset, need_rsp,
+                       is_prep, value);
+
   CallbackEnv sCallbackEnv(__func__);
   if (!sCallbackEnv.valid()) return;
 
@@ -683,6 +1148,8 @@ void btgatts_request_write_descriptor_cb(int conn_id, int trans_id,
 
 void btgatts_request_exec_write_cb(int conn_id, int trans_id,
                                    const RawAddress& bda, int exec_write) {
+  server_cccd_on_exec_write(conn_id, trans_id, exec_write);
+
   CallbackEnv sCallbackEnv(__func__);
   if (!sCallbackEnv.valid()) return;
 
@@ -700,6 +1167,8 @@ void btgatts_response_confirmation_cb(int status, int handle) {
 }
 
 void btgatts_indication_sent_cb(int conn_id, int status) {
+  if (!server_queue_on_sent(conn_id, &status)) return;
+
   CallbackEnv sCallbackEnv(__func__);
   if (!sCallbackEnv.valid()) return;
   sCallbackEnv->CallVoidMethod(mCallbacksObj, method_onNotificationSent,
@@ -707,6 +1176,8 @@ void btgatts_indication_sent_cb(int conn_id, int status) {
 }
 
 void btgatts_congestion_cb(int conn_id, bool congested) {
+  server_queue_on_congestion(conn_id, congested);
+
   CallbackEnv sCallbackEnv(__func__);
   if (!sCallbackEnv.valid()) return;
   sCallbackEnv->CallVoidMethod(mCallbacksObj, method_onServerCongestion,
@@ -714,6 +1185,8 @@ void btgatts_congestion_cb(int conn_id, bool congested) {
 }
 
 void btgatts_mtu_changed_cb(int conn_id, int mtu) {
+  server_queue_on_mtu_changed(conn_id, mtu);
+
   CallbackEnv sCallbackEnv(__func__);
   if (!sCallbackEnv.valid()) return;
   sCallbackEnv->CallVoidMethod(mCallbacksObj, method_onServerMtuChanged,
@@ -765,113 +1238,79 @@ static const btgatt_callbacks_t sGattCallbacks = {
     &sGattScannerCallbacks,
 };
 
+static const JniMethod sJavaMethods[] = {
+    // Client callbacks
+    {&method_onClientRegistered, "onClientRegistered", "(IIJJ)V"},
+    {&method_onScannerRegistered, "onScannerRegistered", "(IIJJ)V"},
+    {&method_onScanResult, "onScanResult", "(IILjava/lang/String;IIIIII[B)V"},
+    {&method_onConnected, "onConnected", "(IIILjava/lang/String;)V"},
+    {&method_onDisconnected, "onDisconnected", "(IIILjava/lang/String;)V"},
+    {&method_onReadCharacteristic, "onReadCharacteristic", "(III[B)V"},
+    {&method_onWriteCharacteristic, "onWriteCharacteristic", "(III)V"},
+    {&method_onExecuteCompleted, "onExecuteCompleted", "(II)V"},
+    {&method_onSearchCompleted, "onSearchCompleted", "(II)V"},
+    {&method_onReadDescriptor, "onReadDescriptor", "(III[B)V"},
+    {&method_onWriteDescriptor, "onWriteDescriptor", "(III)V"},
+    {&method_onNotify, "onNotify", "(ILjava/lang/String;IZ[B)V"},
+    {&method_onRegisterForNotifications, "onRegisterForNotifications",
+     "(IIII)V"},
+    {&method_onReadRemoteRssi, "onReadRemoteRssi", "(ILjava/lang/String;II)V"},
+    {&method_onConfigureMTU, "onConfigureMTU", "(III)V"},
+    {&method_onScanFilterConfig, "onScanFilterConfig", "(IIIII)V"},
+    {&method_onScanFilterParamsConfigured, "onScanFilterParamsConfigured",
+     "(IIII)V"},
+    {&method_onScanFilterEnableDisabled, "onScanFilterEnableDisabled",
+     "(III)V"},
+    {&method_onClientCongestion, "onClientCongestion", "(IZ)V"},
+    {&method_onBatchScanStorageConfigured, "onBatchScanStorageConfigured",
+     "(II)V"},
+    {&method_onBatchScanStartStopped, "onBatchScanStartStopped", "(III)V"},
+    {&method_onBatchScanReports, "onBatchScanReports", "(IIII[B)V"},
+    {&method_onBatchScanThresholdCrossed, "onBatchScanThresholdCrossed",
+     "(I)V"},
+    {&method_createOnTrackAdvFoundLostObject, "createOnTrackAdvFoundLostObject",
+     "(II[BI[BIIILjava/lang/String;"
+     "IIII)Lcom/android/bluetooth/gatt/AdvtFilterOnFoundOnLostInfo;"},
+    {&method_onTrackAdvFoundLost, "onTrackAdvFoundLost",
+     "(Lcom/android/bluetooth/gatt/AdvtFilterOnFoundOnLostInfo;)V"},
+    {&method_onScanParamSetupCompleted, "onScanParamSetupCompleted", "(II)V"},
+    {&method_getSampleGattDbElement, "getSampleGattDbElement",
+     "()Lcom/android/bluetooth/gatt/GattDbElement;"},
+    {&method_onGetGattDb, "onGetGattDb", "(ILjava/util/ArrayList;)V"},
+    {&method_onClientPhyRead, "onClientPhyRead", "(ILjava/lang/String;III)V"},
+    {&method_onClientPhyUpdate, "onClientPhyUpdate", "(IIII)V"},
+    {&method_onClientConnUpdate, "onClientConnUpdate", "(IIIII)V"},
+
+    // Server callbacks
+    {&method_onServerRegistered, "onServerRegistered", "(IIJJ)V"},
+    {&method_onClientConnected, "onClientConnected",
+     "(Ljava/lang/String;ZII)V"},
+    {&method_onServiceAdded, "onServiceAdded", "(IILjava/util/List;)V"},
+    {&method_onServiceStopped, "onServiceStopped", "(III)V"},
+    {&method_onServiceDeleted, "onServiceDeleted", "(III)V"},
+    {&method_onResponseSendCompleted, "onResponseSendCompleted", "(II)V"},
+    {&method_onServerReadCharacteristic, "onServerReadCharacteristic",
+     "(Ljava/lang/String;IIIIZ)V"},
+    {&method_onServerReadDescriptor, "onServerReadDescriptor",
+     "(Ljava/lang/String;IIIIZ)V"},
+    {&method_onServerWriteCharacteristic, "onServerWriteCharacteristic",
+     "(Ljava/lang/String;IIIIIZZ[B)V"},
+    {&method_onServerWriteDescriptor, "onServerWriteDescriptor",
+     "(Ljava/lang/String;IIIIIZZ[B)V"},
+    {&method_onExecuteWrite, "onExecuteWrite", "(Ljava/lang/String;III)V"},
+    {&method_onNotificationSent, "onNotificationSent", "(II)V"},
+    {&method_onServerCongestion, "onServerCongestion", "(IZ)V"},
+    {&method_onServerMtuChanged, "onMtuChanged", "(II)V"},
+    {&method_onServerPhyRead, "onServerPhyRead", "(ILjava/lang/String;III)V"},
+    {&method_onServerPhyUpdate, "onServerPhyUpdate", "(IIII)V"},
+    {&method_onServerConnUpdate, "onServerConnUpdate", "(IIIII)V"},
+};
+
 /**
  * Native function definitions
  */
 static void classInitNative(JNIEnv* env, jclass clazz) {
-  // Client callbacks
-
-  method_onClientRegistered =
-      env->GetMethodID(clazz, "onClientRegistered", "(IIJJ)V");
-  method_onScannerRegistered =
-      env->GetMethodID(clazz, "onScannerRegistered", "(IIJJ)V");
-  method_onScanResult = env->GetMethodID(clazz, "onScanResult",
-                                         "(IILjava/lang/String;IIIIII[B)V");
-  method_onConnected =
-      env->GetMethodID(clazz, "onConnected", "(IIILjava/lang/String;)V");
-  method_onDisconnected =
-      env->GetMethodID(clazz, "onDisconnected", "(IIILjava/lang/String;)V");
-  method_onReadCharacteristic =
-      env->GetMethodID(clazz, "onReadCharacteristic", "(III[B)V");
-  method_onWriteCharacteristic =
-      env->GetMethodID(clazz, "onWriteCharacteristic", "(III)V");
-  method_onExecuteCompleted =
-      env->GetMethodID(clazz, "onExecuteCompleted", "(II)V");
-  method_onSearchCompleted =
-      env->GetMethodID(clazz, "onSearchCompleted", "(II)V");
-  method_onReadDescriptor =
-      env->GetMethodID(clazz, "onReadDescriptor", "(III[B)V");
-  method_onWriteDescriptor =
-      env->GetMethodID(clazz, "onWriteDescriptor", "(III)V");
-  method_onNotify =
-      env->GetMethodID(clazz, "onNotify", "(ILjava/lang/String;IZ[B)V");
-  method_onRegisterForNotifications =
-      env->GetMethodID(clazz, "onRegisterForNotifications", "(IIII)V");
-  method_onReadRemoteRssi =
-      env->GetMethodID(clazz, "onReadRemoteRssi", "(ILjava/lang/String;II)V");
-  method_onConfigureMTU = env->GetMethodID(clazz, "onConfigureMTU", "(III)V");
-  method_onScanFilterConfig =
-      env->GetMethodID(clazz, "onScanFilterConfig", "(IIIII)V");
-  method_onScanFilterParamsConfigured =
-      env->GetMethodID(clazz, "onScanFilterParamsConfigured", "(IIII)V");
-  method_onScanFilterEnableDisabled =
-      env->GetMethodID(clazz, "onScanFilterEnableDisabled", "(III)V");
-  method_onClientCongestion =
-      env->GetMethodID(clazz, "onClientCongestion", "(IZ)V");
-  method_onBatchScanStorageConfigured =
-      env->GetMethodID(clazz, "onBatchScanStorageConfigured", "(II)V");
-  method_onBatchScanStartStopped =
-      env->GetMethodID(clazz, "onBatchScanStartStopped", "(III)V");
-  method_onBatchScanReports =
-      env->GetMethodID(clazz, "onBatchScanReports", "(IIII[B)V");
-  method_onBatchScanThresholdCrossed =
-      env->GetMethodID(clazz, "onBatchScanThresholdCrossed", "(I)V");
-  method_createOnTrackAdvFoundLostObject =
-      env->GetMethodID(clazz, "createOnTrackAdvFoundLostObject",
-                       "(II[BI[BIIILjava/lang/String;IIII)Lcom/android/"
-                       "bluetooth/gatt/AdvtFilterOnFoundOnLostInfo;");
-  method_onTrackAdvFoundLost = env->GetMethodID(
-      clazz, "onTrackAdvFoundLost",
-      "(Lcom/android/bluetooth/gatt/AdvtFilterOnFoundOnLostInfo;)V");
-  method_onScanParamSetupCompleted =
-      env->GetMethodID(clazz, "onScanParamSetupCompleted", "(II)V");
-  method_getSampleGattDbElement =
-      env->GetMethodID(clazz, "getSampleGattDbElement",
-                       "()Lcom/android/bluetooth/gatt/GattDbElement;");
-  method_onGetGattDb =
-      env->GetMethodID(clazz, "onGetGattDb", "(ILjava/util/ArrayList;)V");
-  method_onClientPhyRead =
-      env->GetMethodID(clazz, "onClientPhyRead", "(ILjava/lang/String;III)V");
-  method_onClientPhyUpdate =
-      env->GetMethodID(clazz, "onClientPhyUpdate", "(IIII)V");
-  method_onClientConnUpdate =
-      env->GetMethodID(clazz, "onClientConnUpdate", "(IIIII)V");
-
-  // Server callbacks
-
-  method_onServerRegistered =
-      env->GetMethodID(clazz, "onServerRegistered", "(IIJJ)V");
-  method_onClientConnected =
-      env->GetMethodID(clazz, "onClientConnected", "(Ljava/lang/String;ZII)V");
-  method_onServiceAdded =
-      env->GetMethodID(clazz, "onServiceAdded", "(IILjava/util/List;)V");
-  method_onServiceStopped =
-      env->GetMethodID(clazz, "onServiceStopped", "(III)V");
-  method_onServiceDeleted =
-      env->GetMethodID(clazz, "onServiceDeleted", "(III)V");
-  method_onResponseSendCompleted =
-      env->GetMethodID(clazz, "onResponseSendCompleted", "(II)V");
-  method_onServerReadCharacteristic = env->GetMethodID(
-      clazz, "onServerReadCharacteristic", "(Ljava/lang/String;IIIIZ)V");
-  method_onServerReadDescriptor = env->GetMethodID(
-      clazz, "onServerReadDescriptor", "(Ljava/lang/String;IIIIZ)V");
-  method_onServerWriteCharacteristic = env->GetMethodID(
-      clazz, "onServerWriteCharacteristic", "(Ljava/lang/String;IIIIIZZ[B)V");
-  method_onServerWriteDescriptor = env->GetMethodID(
-      clazz, "onServerWriteDescriptor", "(Ljava/lang/String;IIIIIZZ[B)V");
-  method_onExecuteWrite =
-      env->GetMethodID(clazz, "onExecuteWrite", "(Ljava/lang/String;III)V");
-  method_onNotificationSent =
-      env->GetMethodID(clazz, "onNotificationSent", "(II)V");
-  method_onServerCongestion =
-      env->GetMethodID(clazz, "onServerCongestion", "(IZ)V");
-  method_onServerMtuChanged = env->GetMethodID(clazz, "onMtuChanged", "(II)V");
-  method_onServerPhyRead =
-      env->GetMethodID(clazz, "onServerPhyRead", "(ILjava/lang/String;III)V");
-  method_onServerPhyUpdate =
-      env->GetMethodID(clazz, "onServerPhyUpdate", "(IIII)V");
-  method_onServerConnUpdate =
-      env->GetMethodID(clazz, "onServerConnUpdate", "(IIIII)V");
+  if (!bindJniMethods(env, clazz, sJavaMethods, "gatt")) return;
 
   info("classInitNative: Success!");
 }
@@ -919,6 +1358,8 @@ static void initializeNative(JNIEnv* env, jobject object) {
 static void cleanupNative(JNIEnv* env, jobject object) {
   if (!btIf) return;
 
+  server_queue_clear();
+
   if (sGattIf != NULL) {
     sGattIf->cleanup();
     sGattIf = NULL;
@@ -1614,34 +2055,97 @@ static void gattServerDeleteServiceNative(JNIEnv* env, jobject object,
   sGattIf->server->delete_service(server_if, svc_handle);
 }
 
-static void gattServerSendIndicationNative(JNIEnv* env, jobject object,
-                                           jint server_if, jint attr_handle,
-                                           jint conn_id, jbyteArray val) {
-  if (!sGattIf) return;
-
-  jbyte* array = env->GetByteArrayElements(val, 0);
-  int val_len = env->GetArrayLength(val);
+// Returns kGattSuccess once the value is queued. kServerQueueReplaced or any
+// other status means the value was replaced or refused, and no
+// onNotificationSent will follow for it. A framed value is never replaced.
+static jint gattServerQueueNotificationNative(JNIEnv* env, jobject object,
+                                              jint server_if, jint attr_handle,
+                                              jint conn_id, jboolean confirm,
+                                              jboolean latest_only,
+                                              jboolean framed,
+                                              jbyteArray val) {
+  if (!sGattIf) return kGattError;
+
+  if (val == NULL) {
+    warn("gattServerQueueNotificationNative() ignoring NULL array");
+    return kGattError;
+  }
 
-  std::vector<uint8_t> vect_val((uint8_t*)array, (uint8_t*)array + val_len);
-  env->ReleaseByteArrayElements(val, array, JNI_ABORT);
+  std::vector<uint8_t> value = toVector(env, val);
 
-  sGattIf->server->send_indication(server_if, attr_handle, conn_id,
-                                   /*confirm*/ 1, std::move(vect_val));
-}
+  std::lock_guard<std::mutex> send_lock(sServerSendMutex);
+  std::vector<ServerSend> batch;
+  {
+    std::lock_guard<std::mutex> lock(sServerQueueMutex);
+    if (!server_cccd_is_subscribed_locked(conn_id, attr_handle, confirm)) {
+      return kGattCccCfgErr;
+    }
 
-static void gattServerSendNotificationNative(JNIEnv* env, jobject object,
-                                             jint server_if, jint attr_handle,
-                                             jint conn_id, jbyteArray val) {
-  if (!sGattIf) return;
+    auto it = sServerQueues.find(conn_id);
+    if (it == sServerQueues.end()) {
+      warn("conn_id=%d is not connected, refusing handle=%d", conn_id,
+           attr_handle);
+      return kGattError;
+    }
 
-  jbyte* array = env->GetByteArrayElements(val, 0);
-  int val_len = env->GetArrayLength(val);
+    ServerConnQueue& queue = it->second;
+    if (latest_only && !confirm && !framed) {
+      for (PendingNotification& item : queue.pending) {
+        if (item.server_if == server_if && item.attr_handle == attr_handle &&
+            !item.confirm) {
+          item.value = std::move(value);
+          return kServerQueueReplaced;
+        }
+      }
+    }
 
-  std::vector<uint8_t> vect_val((uint8_t*)array, (uint8_t*)array + val_len);
-  env->ReleaseByteArrayElements(val, array, JNI_ABORT);
+    if (framed) {
+      if (!server_queue_push_framed_locked(&queue, server_if, attr_handle,
+                                           confirm, value)) {
+        warn("conn_id=%d notification queue full, refusing framed handle=%d",
+             conn_id, attr_handle);
+        return kGattNoResources;
+      }
+    } else {
+      if (queue.pending.size() >= kServerQueueMaxDepth) {
+        warn("conn_id=%d notification queue full, refusing handle=%d",
+             conn_id, attr_handle);
+        return kGattNoResources;
+      }
+      queue.pending.push_back(
+          {server_if, attr_handle, (bool)confirm, std::move(value)});
+    }
+    batch = server_queue_dispatch_locked();
+  }
+  server_queue_send(std::move(batch));
+  return kGattSuccess;
+}
+
+static void gattServerRestoreSubscriptionsNative(JNIEnv* env, jobject object,
+                                                jint conn_id,
+                                                jboolean bonded) {
+  server_cccd_restore(conn_id, bonded);
+}
+
+// Returns the enabled subscriptions of all connections, as conn_id,
+// characteristic handle and CCCD value triples.
+static jintArray gattServerGetSubscriptionsNative(JNIEnv* env,
+                                                  jobject object) {
+  std::vector<jint> triples;
+  {
+    std::lock_guard<std::mutex> lock(sServerQueueMutex);
+    for (const auto& conn : sServerQueues) {
+      for (const auto& sub : conn.second.subscriptions) {
+        if (sub.second == 0) continue;
+        triples.insert(triples.end(), {conn.first, sub.first, sub.second});
+      }
+    }
+  }
 
-  sGattIf->server->send_indication(server_if, attr_handle, conn_id,
-                                   /*confirm*/ 0, std::move(vect_val));
+  jintArray result = env->NewIntArray(triples.size());
+  if (result == NULL) return NULL;
+  env->SetIntArrayRegion(result, 0, triples.size(), triples.data());
+  return result;
 }
 
 static void gattServerSendResponseNative(JNIEnv* env, jobject object,
@@ -1673,28 +2177,38 @@ static void gattServerSendResponseNative(JNIEnv* env, jobject object,
     env->ReleaseByteArrayElements(val, array, JNI_ABORT);
   }
 
+  server_cccd_on_response(conn_id, trans_id, status);
   sGattIf->server->send_response(conn_id, trans_id, status, response);
 }
 
+static const JniMethod sAdvertiseJavaMethods[] = {
+    {&method_onAdvertisingSetStarted, "onAdvertisingSetStarted", "(IIII)V"},
+    {&method_onOwnAddressRead, "onOwnAddressRead", "(IILjava/lang/String;)V"},
+    {&method_onAdvertisingEnabled, "onAdvertisingEnabled", "(IZI)V"},
+    {&method_onAdvertisingDataSet, "onAdvertisingDataSet", "(II)V"},
+    {&method_onScanResponseDataSet, "onScanResponseDataSet", "(II)V"},
+    {&method_onAdvertisingParametersUpdated, "onAdvertisingParametersUpdated",
+     "(III)V"},
+    {&method_onPeriodicAdvertisingParametersUpdated,
+     "onPeriodicAdvertisingParametersUpdated", "(II)V"},
+    {&method_onPeriodicAdvertisingDataSet, "onPeriodicAdvertisingDataSet",
+     "(II)V"},
+    {&method_onPeriodicAdvertisingEnabled, "onPeriodicAdvertisingEnabled",
+     "(IZI)V"},
+};
+
 static void advertiseClassInitNative(JNIEnv* env, jclass clazz) {
-  method_onAdvertisingSetStarted =
-      env->GetMethodID(clazz, "onAdvertisingSetStarted", "(IIII)V");
-  method_onOwnAddressRead =
-      env->GetMethodID(clazz, "onOwnAddressRead", "(IILjava/lang/String;)V");
-  method_onAdvertisingEnabled =
-      env->GetMethodID(clazz, "onAdvertisingEnabled", "(IZI)V");
-  method_onAdvertisingDataSet =
-      env->GetMethodID(clazz, "onAdvertisingDataSet", "(II)V");
-  method_onScanResponseDataSet =
-      env->GetMethodID(clazz, "onScanResponseDataSet", "(II)V");
-  method_onAdvertisingParametersUpdated =
-      env->GetMethodID(clazz, "onAdvertisingParametersUpdated", "(III)V");
-  method_onPeriodicAdvertisingParametersUpdated = env->GetMethodID(
-      clazz, "onPeriodicAdvertisingParametersUpdated", "(II)V");
-  method_onPeriodicAdvertisingDataSet =
-      env->GetMethodID(clazz, "onPeriodicAdvertisingDataSet", "(II)V");
-  method_onPeriodicAdvertisingEnabled =
-      env->GetMethodID(clazz, "onPeriodicAdvertisingEnabled", "(IZI)V");
+  if (!bindJniMethods(env, clazz, sAdvertiseJavaMethods, "gatt advertise")) {
+    return;
+  }
+
+  ScopedLocalRef<jclass> periodicParamsClazz(
+      env,
+      env->FindClass("android/bluetooth/le/PeriodicAdvertisingParameters"));
+  android_bluetooth_le_PeriodicAdvParams.getIncludeTxPower =
+      env->GetMethodID(periodicParamsClazz.get(), "getIncludeTxPower", "()Z");
+  android_bluetooth_le_PeriodicAdvParams.getInterval =
+      env->GetMethodID(periodicParamsClazz.get(), "getInterval", "()I");
 }
 
 static void advertiseInitializeNative(JNIEnv* env, jobject object) {
@@ -1707,7 +2221,15 @@ static void advertiseInitializeNative(JNIEnv* env, jobject object) {
   mAdvertiseCallbacksObj = env->NewGlobalRef(object);
 }
 
+static void adv_mux_shutdown();
+static void adv_data_clear();
+static void adv_metrics_retire_all();
+
 static void advertiseCleanupNative(JNIEnv* env, jobject object) {
+  adv_mux_shutdown();
+  adv_data_clear();
+  adv_metrics_retire_all();
+
   if (mAdvertiseCallbacksObj != NULL) {
     env->DeleteGlobalRef(mAdvertiseCallbacksObj);
     mAdvertiseCallbacksObj = NULL;
@@ -1718,30 +2240,35 @@ static uint32_t INTERVAL_MAX = 0xFFFFFF;
 // Always give controller 31.25ms difference between min and max
 static uint32_t INTERVAL_DELTA = 50;
 
-static AdvertiseParameters parseParams(JNIEnv* env, jobject i) {
-  AdvertiseParameters p;
+// Layout of the packed int[] form of AdvertisingSetParameters; must match
+// AdvertiseManager.PACKED_PARAM_*.
+enum {
+  ADV_PARAM_CONNECTABLE,
+  ADV_PARAM_SCANNABLE,
+  ADV_PARAM_LEGACY,
+  ADV_PARAM_ANONYMOUS,
+  ADV_PARAM_INCLUDE_TX_POWER,
+  ADV_PARAM_PRIMARY_PHY,
+  ADV_PARAM_SECONDARY_PHY,
+  ADV_PARAM_INTERVAL,
+  ADV_PARAM_TX_POWER_LEVEL,
+  ADV_PARAM_COUNT,
+};
+
+// Layout of the packed int[] form of PeriodicAdvertisingParameters.
+enum {
+  PERIODIC_PARAM_ENABLE,
+  PERIODIC_PARAM_INCLUDE_TX_POWER,
+  PERIODIC_PARAM_INTERVAL,
+  PERIODIC_PARAM_COUNT,
+};
 
-  jclass clazz = env->GetObjectClass(i);
-  jmethodID methodId;
-
-  methodId = env->GetMethodID(clazz, "isConnectable", "()Z");
-  jboolean isConnectable = env->CallBooleanMethod(i, methodId);
-  methodId = env->GetMethodID(clazz, "isScannable", "()Z");
-  jboolean isScannable = env->CallBooleanMethod(i, methodId);
-  methodId = env->GetMethodID(clazz, "isLegacy", "()Z");
-  jboolean isLegacy = env->CallBooleanMethod(i, methodId);
-  methodId = env->GetMethodID(clazz, "isAnonymous", "()Z");
-  jboolean isAnonymous = env->CallBooleanMethod(i, methodId);
-  methodId = env->GetMethodID(clazz, "includeTxPower", "()Z");
-  jboolean includeTxPower = env->CallBooleanMethod(i, methodId);
-  methodId = env->GetMethodID(clazz, "getPrimaryPhy", "()I");
-  uint8_t primaryPhy = env->CallIntMethod(i, methodId);
-  methodId = env->GetMethodID(clazz, "getSecondaryPhy", "()I");
-  uint8_t secondaryPhy = env->CallIntMethod(i, methodId);
-  methodId = env->GetMethodID(clazz, "getInterval", "()I");
-  uint32_t interval = env->CallIntMethod(i, methodId);
-  methodId = env->GetMethodID(clazz, "getTxPowerLevel", "()I");
-  int8_t txPowerLevel = env->CallIntMethod(i, methodId);
+static AdvertiseParameters buildParams(bool isConnectable, bool isScannable,
+                                       bool isLegacy, bool isAnonymous,
+                                       bool includeTxPower, uint8_t primaryPhy,
+                                       uint8_t secondaryPhy, uint32_t interval,
+                                       int8_t txPowerLevel) {
+  AdvertiseParameters p;
 
   uint16_t props = 0;
   if (isConnectable) props |= 0x01;
@@ -1765,23 +2292,29 @@ static AdvertiseParameters parseParams(JNIEnv* env, jobject i) {
   return p;
 }
 
-static PeriodicAdvertisingParameters parsePeriodicParams(JNIEnv* env,
-                                                         jobject i) {
-  PeriodicAdvertisingParameters p;
+// AdvertiseCallback.ADVERTISE_FAILED_INTERNAL_ERROR.
+static constexpr uint8_t kAdvFailedInternalError = 0x04;
 
-  if (i == NULL) {
-    p.enable = false;
-    return p;
+static bool parsePackedParams(JNIEnv* env, jintArray packed,
+                              AdvertiseParameters* p) {
+  if (packed == NULL || env->GetArrayLength(packed) != ADV_PARAM_COUNT) {
+    error("malformed packed advertising parameters");
+    return false;
   }
 
-  jclass clazz = env->GetObjectClass(i);
-  jmethodID methodId;
-
-  methodId = env->GetMethodID(clazz, "getIncludeTxPower", "()Z");
-  jboolean includeTxPower = env->CallBooleanMethod(i, methodId);
-  methodId = env->GetMethodID(clazz, "getInterval", "()I");
-  uint16_t interval = env->CallIntMethod(i, methodId);
+  jint v[ADV_PARAM_COUNT];
+  env->GetIntArrayRegion(packed, 0, ADV_PARAM_COUNT, v);
+  *p = buildParams(v[ADV_PARAM_CONNECTABLE], v[ADV_PARAM_SCANNABLE],
+                   v[ADV_PARAM_LEGACY], v[ADV_PARAM_ANONYMOUS],
+                   v[ADV_PARAM_INCLUDE_TX_POWER], v[ADV_PARAM_PRIMARY_PHY],
+                   v[ADV_PARAM_SECONDARY_PHY], v[ADV_PARAM_INTERVAL],
+                   v[ADV_PARAM_TX_POWER_LEVEL]);
+  return true;
+}
 
+static PeriodicAdvertisingParameters buildPeriodicParams(bool includeTxPower,
+                                                         uint16_t interval) {
+  PeriodicAdvertisingParameters p;
   p.enable = true;
   p.min_interval = interval;
   p.max_interval = interval + 16; /* 20ms difference betwen min and max */
@@ -1791,8 +2324,535 @@ static PeriodicAdvertisingParameters parsePeriodicParams(JNIEnv* env,
   return p;
 }
 
+static PeriodicAdvertisingParameters parsePeriodicParams(JNIEnv* env,
+                                                         jobject i) {
+  if (i == NULL) {
+    PeriodicAdvertisingParameters p;
+    p.enable = false;
+    return p;
+  }
+
+  jboolean includeTxPower = env->CallBooleanMethod(
+      i, android_bluetooth_le_PeriodicAdvParams.getIncludeTxPower);
+  jint interval =
+      env->CallIntMethod(i, android_bluetooth_le_PeriodicAdvParams.getInterval);
+  return buildPeriodicParams(includeTxPower, interval);
+}
+
+static PeriodicAdvertisingParameters parsePackedPeriodicParams(
+    JNIEnv* env, jintArray packed) {
+  jint v[PERIODIC_PARAM_COUNT] = {0};
+  if (packed != NULL &&
+      env->GetArrayLength(packed) == PERIODIC_PARAM_COUNT) {
+    env->GetIntArrayRegion(packed, 0, PERIODIC_PARAM_COUNT, v);
+  }
+
+  if (!v[PERIODIC_PARAM_ENABLE]) {
+    PeriodicAdvertisingParameters p;
+    p.enable = false;
+    return p;
+  }
+
+  return buildPeriodicParams(v[PERIODIC_PARAM_INCLUDE_TX_POWER],
+                             v[PERIODIC_PARAM_INTERVAL]);
+}
+
+/**
+ * Advertising lifecycle metrics
+ *
+ * Counts every advertising operation per advertiser_id and measures how long
+ * the stack takes to acknowledge it. Latencies go into power-of-two buckets
+ * of milliseconds: bucket 0 holds < 1ms, bucket i holds [2^(i-1), 2^i) ms and
+ * the last bucket everything above. Start latency is measured from the start
+ * request to ble_advertising_set_started_cb and is filed under the
+ * advertiser_id the stack assigned.
+ */
+enum AdvOp {
+  ADV_OP_START,
+  ADV_OP_TIMEOUT,
+  ADV_OP_ENABLE,
+  ADV_OP_PARAMETERS,
+  ADV_OP_DATA,
+  ADV_OP_SCAN_RESPONSE,
+  ADV_OP_PERIODIC_PARAMETERS,
+  ADV_OP_PERIODIC_DATA,
+  ADV_OP_PERIODIC_ENABLE,
+  ADV_OP_COUNT,
+};
+
+static const char* const kAdvOpNames[ADV_OP_COUNT] = {
+    "start",           "timeout",       "enable",
+    "parameters",      "data",          "scan_response",
+    "periodic_params", "periodic_data", "periodic_enable",
+};
+
+static constexpr size_t kAdvLatencyBuckets = 12;
+
+struct AdvOpStats {
+  uint64_t count = 0;
+  uint64_t failures = 0;
+  uint64_t total_us = 0;
+  uint64_t max_us = 0;
+  std::array<uint32_t, kAdvLatencyBuckets> buckets = {};
+};
+
+struct AdvSetMetrics {
+  std::array<AdvOpStats, ADV_OP_COUNT> ops;
+  // Requests awaiting acknowledgement; the stack answers them in order.
+  std::array<std::deque<std::chrono::steady_clock::time_point>, ADV_OP_COUNT>
+      pending;
+};
+
+// Stats of stopped sets are folded into one entry, reported under this id,
+// so that the map only holds sets that are currently registered.
+static constexpr uint8_t kAdvMetricsRetiredId = 0xFF;
+
+static std::mutex sAdvMetricsMutex;
+static std::map<uint8_t, AdvSetMetrics> sAdvMetrics;
+static std::array<AdvOpStats, ADV_OP_COUNT> sAdvMetricsRetired;
+static std::map<int, std::chrono::steady_clock::time_point> sAdvStartTimes;
+
+static void callJniCallback(jmethodID method, uint8_t advertiser_id,
+                            uint8_t status);
+static void enableSetCb(uint8_t advertiser_id, bool enable, uint8_t status);
+
+static size_t adv_latency_bucket(uint64_t latency_us) {
+  size_t bucket = 0;
+  for (uint64_t ms = latency_us / 1000; ms > 0; ms >>= 1) bucket++;
+  return std::min(bucket, kAdvLatencyBuckets - 1);
+}
+
+// Must be called with sAdvMetricsMutex held.
+static void adv_metrics_record_locked(
+    uint8_t advertiser_id, AdvOp op, uint8_t status,
+    std::chrono::steady_clock::time_point begin) {
+  uint64_t latency_us =
+      std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::steady_clock::now() - begin)
+          .count();
+
+  AdvOpStats& stats = sAdvMetrics[advertiser_id].ops[op];
+  stats.count++;
+  if (status != 0) stats.failures++;
+  stats.total_us += latency_us;
+  stats.max_us = std::max(stats.max_us, latency_us);
+  stats.buckets[adv_latency_bucket(latency_us)]++;
+}
+
+static void adv_metrics_start_begin(int reg_id) {
+  std::lock_guard<std::mutex> lock(sAdvMetricsMutex);
+  sAdvStartTimes[reg_id] = std::chrono::steady_clock::now();
+}
+
+static void adv_metrics_retire_locked(
+    std::map<uint8_t, AdvSetMetrics>::iterator it);
+
+static void adv_metrics_start_end(int reg_id, uint8_t advertiser_id,
+                                  uint8_t status) {
+  std::lock_guard<std::mutex> lock(sAdvMetricsMutex);
+  auto it = sAdvStartTimes.find(reg_id);
+  if (it == sAdvStartTimes.end()) return;
+
+  adv_metrics_record_locked(advertiser_id, ADV_OP_START, status, it->second);
+  sAdvStartTimes.erase(it);
+  // A set that failed to start is never stopped.
+  if (status != 0) adv_metrics_retire_locked(sAdvMetrics.find(advertiser_id));
+}
+
+static void adv_metrics_begin(uint8_t advertiser_id, AdvOp op) {
+  std::lock_guard<std::mutex> lock(sAdvMetricsMutex);
+  sAdvMetrics[advertiser_id].pending[op].push_back(
+      std::chrono::steady_clock::now());
+}
+
+// Acknowledgements without a matching request, e.g. for updates made by the
+// multiplexer, are not measured.
+static void adv_metrics_end(uint8_t advertiser_id, AdvOp op, uint8_t status) {
+  std::lock_guard<std::mutex> lock(sAdvMetricsMutex);
+  auto it = sAdvMetrics.find(advertiser_id);
+  if (it == sAdvMetrics.end() || it->second.pending[op].empty()) return;
+
+  auto begin = it->second.pending[op].front();
+  it->second.pending[op].pop_front();
+  adv_metrics_record_locked(advertiser_id, op, status, begin);
+}
+
+static void adv_metrics_count(uint8_t advertiser_id, AdvOp op,
+                              uint8_t status) {
+  std::lock_guard<std::mutex> lock(sAdvMetricsMutex);
+  AdvOpStats& stats = sAdvMetrics[advertiser_id].ops[op];
+  stats.count++;
+  if (status != 0) stats.failures++;
+}
+
+// Folds the stats of a set that is going away into the retired entry and
+// drops its outstanding requests with it, so that their acknowledgements are
+// not charged to the next set with the same id. Must be called with
+// sAdvMetricsMutex held.
+static void adv_metrics_retire_locked(
+    std::map<uint8_t, AdvSetMetrics>::iterator it) {
+  if (it == sAdvMetrics.end()) return;
+
+  for (int op = 0; op < ADV_OP_COUNT; op++) {
+    const AdvOpStats& stats = it->second.ops[op];
+    AdvOpStats& retired = sAdvMetricsRetired[op];
+    retired.count += stats.count;
+    retired.failures += stats.failures;
+    retired.total_us += stats.total_us;
+    retired.max_us = std::max(retired.max_us, stats.max_us);
+    for (size_t i = 0; i < kAdvLatencyBuckets; i++) {
+      retired.buckets[i] += stats.buckets[i];
+    }
+  }
+  sAdvMetrics.erase(it);
+}
+
+static void adv_metrics_retire(uint8_t advertiser_id) {
+  std::lock_guard<std::mutex> lock(sAdvMetricsMutex);
+  adv_metrics_retire_locked(sAdvMetrics.find(advertiser_id));
+}
+
+static void adv_metrics_retire_all() {
+  std::lock_guard<std::mutex> lock(sAdvMetricsMutex);
+  sAdvStartTimes.clear();
+  while (!sAdvMetrics.empty()) adv_metrics_retire_locked(sAdvMetrics.begin());
+}
+
+// Calls |fn| with the id, op and stats of every op that was used, live sets
+// first. Must be called with sAdvMetricsMutex held.
+template <typename Fn>
+static void adv_metrics_for_each_locked(Fn fn) {
+  for (const auto& entry : sAdvMetrics) {
+    for (int op = 0; op < ADV_OP_COUNT; op++) {
+      if (entry.second.ops[op].count) fn(entry.first, op, entry.second.ops[op]);
+    }
+  }
+  for (int op = 0; op < ADV_OP_COUNT; op++) {
+    if (sAdvMetricsRetired[op].count) {
+      fn(kAdvMetricsRetiredId, op, sAdvMetricsRetired[op]);
+    }
+  }
+}
+
+static void adv_op_cb(AdvOp op, jmethodID method, uint8_t advertiser_id,
+                      uint8_t status) {
+  adv_metrics_end(advertiser_id, op, status);
+  callJniCallback(method, advertiser_id, status);
+}
+
+/**
+ * Advertising data cache
+ *
+ * Remembers the last payload sent for each set and kind of data, so that
+ * updates identical to what the controller already has are answered without
+ * going to the stack. A payload only counts as on the controller once the
+ * latest update carrying it has completed successfully. Updates for sets this
+ * process started are also checked for length and AD structure before they
+ * are sent; sets it does not track are passed through unchecked.
+ */
+enum AdvDataKind {
+  ADV_DATA_ADVERTISING,
+  ADV_DATA_SCAN_RESPONSE,
+  ADV_DATA_PERIODIC,
+  ADV_DATA_KIND_COUNT,
+};
+
+struct AdvDataState {
+  bool legacy = false;
+  bool connectable = false;
+  // |last| is known to be on the controller.
+  std::array<bool, ADV_DATA_KIND_COUNT> known = {};
+  // Bumped for every update sent, so only the latest completion counts.
+  std::array<uint32_t, ADV_DATA_KIND_COUNT> seq = {};
+  std::array<std::vector<uint8_t>, ADV_DATA_KIND_COUNT> last;
+};
+
+static constexpr size_t kAdvLegacyMaxLen = 31;
+// Flags AD structure the stack prepends to the data of connectable sets.
+static constexpr size_t kAdvFlagsLen = 3;
+static constexpr size_t kAdvExtendedMaxLen = 1650;
+static constexpr uint8_t kAdvFailedDataTooLarge = 0x01;
+
+static std::mutex sAdvDataMutex;
+// Keyed by reg_id until the stack assigns an advertiser_id.
+static std::map<int, AdvDataState> sAdvDataPending;
+static std::map<int, AdvDataState> sAdvDataStates;
+
+/**
+ * Periodic data updates are paced by the controller: while a write is in
+ * flight for a set, newer payloads replace each other natively and only the
+ * latest one is written once the controller answers. Each update is still
+ * answered once, with the status of the write that carried its payload or
+ * the payload that replaced it. A set is in this map while a write is in
+ * flight.
+ */
+struct PeriodicDataStream {
+  std::vector<uint8_t> pending;
+  // Updates answered by the write of |pending|.
+  uint32_t waiting = 0;
+};
+
+static std::map<int, PeriodicDataStream> sAdvPeriodicStreams;
+
+static bool adv_params_legacy(const AdvertiseParameters& params) {
+  return params.advertising_event_properties & 0x10;
+}
+
+static bool adv_params_connectable(const AdvertiseParameters& params) {
+  return params.advertising_event_properties & 0x01;
+}
+
+static AdvDataState adv_data_initial_state(
+    const AdvertiseParameters& params, const std::vector<uint8_t>& adv_data,
+    const std::vector<uint8_t>& scan_resp) {
+  AdvDataState state;
+  state.legacy = adv_params_legacy(params);
+  state.connectable = adv_params_connectable(params);
+  state.known[ADV_DATA_ADVERTISING] = true;
+  state.last[ADV_DATA_ADVERTISING] = adv_data;
+  state.known[ADV_DATA_SCAN_RESPONSE] = true;
+  state.last[ADV_DATA_SCAN_RESPONSE] = scan_resp;
+  return state;
+}
+
+static void adv_data_track_start(int reg_id, AdvDataState state) {
+  std::lock_guard<std::mutex> lock(sAdvDataMutex);
+  sAdvDataPending[reg_id] = std::move(state);
+}
+
+static void adv_data_on_started(int reg_id, uint8_t advertiser_id,
+                                uint8_t status) {
+  std::lock_guard<std::mutex> lock(sAdvDataMutex);
+  auto it = sAdvDataPending.find(reg_id);
+  if (it == sAdvDataPending.end()) return;
+
+  if (status == 0) sAdvDataStates[advertiser_id] = std::move(it->second);
+  sAdvDataPending.erase(it);
+}
+
+static void adv_data_track(int advertiser_id, AdvDataState state) {
+  std::lock_guard<std::mutex> lock(sAdvDataMutex);
+  sAdvDataStates[advertiser_id] = std::move(state);
+}
+
+static void adv_data_forget(int advertiser_id) {
+  std::lock_guard<std::mutex> lock(sAdvDataMutex);
+  sAdvDataStates.erase(advertiser_id);
+  sAdvPeriodicStreams.erase(advertiser_id);
+}
+
+static void adv_data_set_params(int advertiser_id,
+                                const AdvertiseParameters& params) {
+  std::lock_guard<std::mutex> lock(sAdvDataMutex);
+  auto it = sAdvDataStates.find(advertiser_id);
+  if (it == sAdvDataStates.end()) return;
+
+  it->second.legacy = adv_params_legacy(params);
+  it->second.connectable = adv_params_connectable(params);
+}
+
+static void adv_data_clear() {
+  std::lock_guard<std::mutex> lock(sAdvDataMutex);
+  sAdvDataPending.clear();
+  sAdvDataStates.clear();
+  sAdvPeriodicStreams.clear();
+}
+
+// Each AD structure is a length byte followed by that many bytes of type and
+// data. A zero length ends the significant part; the rest must be padding.
+static bool adv_data_well_formed(const std::vector<uint8_t>& data) {
+  size_t i = 0;
+  while (i < data.size()) {
+    uint8_t len = data[i];
+    if (len == 0) {
+      return std::all_of(data.begin() + i, data.end(),
+                         [](uint8_t b) { return b == 0; });
+    }
+    if (i + 1 + len > data.size()) return false;
+    i += 1 + len;
+  }
+  return true;
+}
+
+static bool adv_data_valid_locked(int advertiser_id, const AdvDataState& state,
+                                  AdvDataKind kind,
+                                  const std::vector<uint8_t>& data,
+                                  uint8_t* status) {
+  size_t max_len = kAdvExtendedMaxLen;
+  if (state.legacy && kind != ADV_DATA_PERIODIC) max_len = kAdvLegacyMaxLen;
+  if (state.connectable && kind == ADV_DATA_ADVERTISING) {
+    max_len -= kAdvFlagsLen;
+  }
+  if (data.size() > max_len) {
+    error("advertiser_id=%d data too large: %zu > %zu", advertiser_id,
+          data.size(), max_len);
+    *status = kAdvFailedDataTooLarge;
+    return false;
+  }
+
+  if (!adv_data_well_formed(data)) {
+    error("advertiser_id=%d malformed AD structure", advertiser_id);
+    *status = kAdvFailedInternalError;
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Checks an update of |kind| for a set this process started. Returns false,
+ * with the error status in |*status|, if it must not be sent.
+ */
+static bool adv_data_check(int advertiser_id, AdvDataKind kind,
+                           const std::vector<uint8_t>& data,
+                           uint8_t* status) {
+  std::lock_guard<std::mutex> lock(sAdvDataMutex);
+  auto it = sAdvDataStates.find(advertiser_id);
+  if (it == sAdvDataStates.end()) return true;
+  return adv_data_valid_locked(advertiser_id, it->second, kind, data, status);
+}
+
+/**
+ * Decides whether an update of |kind| should be sent to the stack. When it
+ * should, |*seq| identifies the update for adv_data_set_cb(). When it should
+ * not, |*status| holds the result to report right away: 0 if the controller
+ * already has this payload, an error status if it is invalid.
+ */
+static bool adv_data_should_send(int advertiser_id, AdvDataKind kind,
+                                 const std::vector<uint8_t>& data,
+                                 uint8_t* status, uint32_t* seq) {
+  std::lock_guard<std::mutex> lock(sAdvDataMutex);
+  *seq = 0;
+  auto it = sAdvDataStates.find(advertiser_id);
+  if (it == sAdvDataStates.end()) return true;
+  AdvDataState& state = it->second;
+
+  if (!adv_data_valid_locked(advertiser_id, state, kind, data, status)) {
+    return false;
+  }
+
+  if (state.known[kind] && state.last[kind] == data) {
+    *status = 0;
+    return false;
+  }
+
+  // Not known to be on the controller until this update completes.
+  state.known[kind] = false;
+  state.last[kind] = data;
+  *seq = ++state.seq[kind];
+  return true;
+}
+
+static void adv_data_on_set(int advertiser_id, AdvDataKind kind, uint32_t seq,
+                            uint8_t status) {
+  std::lock_guard<std::mutex> lock(sAdvDataMutex);
+  auto it = sAdvDataStates.find(advertiser_id);
+  if (it == sAdvDataStates.end() || it->second.seq[kind] != seq) return;
+
+  it->second.known[kind] = (status == 0);
+}
+
+static const AdvOp kAdvDataOps[ADV_DATA_KIND_COUNT] = {
+    ADV_OP_DATA, ADV_OP_SCAN_RESPONSE, ADV_OP_PERIODIC_DATA};
+
+static void adv_data_set_cb(jmethodID method, AdvDataKind kind, uint32_t seq,
+                            uint8_t advertiser_id, uint8_t status) {
+  adv_data_on_set(advertiser_id, kind, seq, status);
+  adv_op_cb(kAdvDataOps[kind], method, advertiser_id, status);
+}
+
+// Returns true if |*data| should be written now. Otherwise a write is in
+// flight for the set, and |*data| is moved to wait for it.
+static bool adv_periodic_stream_offer(int advertiser_id,
+                                      std::vector<uint8_t>* data) {
+  std::lock_guard<std::mutex> lock(sAdvDataMutex);
+  auto it = sAdvPeriodicStreams.find(advertiser_id);
+  if (it == sAdvPeriodicStreams.end()) {
+    sAdvPeriodicStreams[advertiser_id];
+    return true;
+  }
+
+  it->second.pending = std::move(*data);
+  it->second.waiting++;
+  return false;
+}
+
+// Called once the write in flight is done with. Moves the payload waiting
+// for it to |*data| and returns how many updates it answers, or returns 0
+// and leaves the set idle.
+static uint32_t adv_periodic_stream_next(int advertiser_id,
+                                         std::vector<uint8_t>* data) {
+  std::lock_guard<std::mutex> lock(sAdvDataMutex);
+  auto it = sAdvPeriodicStreams.find(advertiser_id);
+  if (it == sAdvPeriodicStreams.end()) return 0;
+  if (it->second.waiting == 0) {
+    sAdvPeriodicStreams.erase(it);
+    return 0;
+  }
+
+  uint32_t waiting = it->second.waiting;
+  *data = std::move(it->second.pending);
+  it->second.pending.clear();
+  it->second.waiting = 0;
+  return waiting;
+}
+
+static void adv_periodic_data_report(JNIEnv* env, int advertiser_id,
+                                     uint8_t status, uint32_t reports) {
+  if (!env || !mAdvertiseCallbacksObj) return;
+  for (uint32_t i = 0; i < reports; i++) {
+    env->CallVoidMethod(mAdvertiseCallbacksObj,
+                        method_onPeriodicAdvertisingDataSet, advertiser_id,
+                        status);
+  }
+}
+
+static void adv_periodic_data_set_cb(uint32_t seq, uint32_t reports,
+                                     uint8_t advertiser_id, uint8_t status);
+
+// Writes |data| for the set whose stream is in flight, answering |reports|
+// updates. Payloads the controller already has are answered right away,
+// and the next waiting payload, if any, is tried instead.
+static void adv_periodic_data_write(JNIEnv* env, int advertiser_id,
+                                    std::vector<uint8_t> data,
+                                    uint32_t reports) {
+  while (reports > 0) {
+    uint8_t status;
+    uint32_t seq;
+    if (adv_data_should_send(advertiser_id, ADV_DATA_PERIODIC, data, &status,
+                             &seq)) {
+      if (!sGattIf) return;
+      adv_metrics_begin(advertiser_id, ADV_OP_PERIODIC_DATA);
+      sGattIf->advertiser->SetPeriodicAdvertisingData(
+          advertiser_id, std::move(data),
+          base::Bind(&adv_periodic_data_set_cb, seq, reports, advertiser_id));
+      return;
+    }
+
+    adv_periodic_data_report(env, advertiser_id, status, reports);
+    reports = adv_periodic_stream_next(advertiser_id, &data);
+  }
+}
+
+static void adv_periodic_data_set_cb(uint32_t seq, uint32_t reports,
+                                     uint8_t advertiser_id, uint8_t status) {
+  adv_data_on_set(advertiser_id, ADV_DATA_PERIODIC, seq, status);
+  adv_metrics_end(advertiser_id, ADV_OP_PERIODIC_DATA, status);
+
+  // Keep the stream moving even if the updates cannot be answered.
+  CallbackEnv sCallbackEnv(__func__);
+  JNIEnv* env = sCallbackEnv.valid() ? sCallbackEnv.get() : nullptr;
+  adv_periodic_data_report(env, advertiser_id, status, reports);
+
+  std::vector<uint8_t> data;
+  reports = adv_periodic_stream_next(advertiser_id, &data);
+  adv_periodic_data_write(env, advertiser_id, std::move(data), reports);
+}
+
 static void ble_advertising_set_started_cb(int reg_id, uint8_t advertiser_id,
                                            int8_t tx_power, uint8_t status) {
+  adv_metrics_start_end(reg_id, advertiser_id, status);
+  adv_data_on_started(reg_id, advertiser_id, status);
+
   CallbackEnv sCallbackEnv(__func__);
   if (!sCallbackEnv.valid()) return;
   sCallbackEnv->CallVoidMethod(mAdvertiseCallbacksObj,
@@ -1802,6 +2862,8 @@ static void ble_advertising_set_started_cb(int reg_id, uint8_t advertiser_id,
 
 static void ble_advertising_set_timeout_cb(uint8_t advertiser_id,
                                            uint8_t status) {
+  adv_metrics_count(advertiser_id, ADV_OP_TIMEOUT, status);
+
   CallbackEnv sCallbackEnv(__func__);
   if (!sCallbackEnv.valid()) return;
   sCallbackEnv->CallVoidMethod(mAdvertiseCallbacksObj,
@@ -1809,38 +2871,453 @@ static void ble_advertising_set_timeout_cb(uint8_t advertiser_id,
                                false, status);
 }
 
-static void startAdvertisingSetNative(JNIEnv* env, jobject object,
-                                      jobject parameters, jbyteArray adv_data,
-                                      jbyteArray scan_resp,
-                                      jobject periodic_parameters,
-                                      jbyteArray periodic_data, jint duration,
-                                      jint maxExtAdvEvents, jint reg_id) {
+/**
+ * Advertising set multiplexer
+ *
+ * When the controller runs out of advertising sets, further sets can be
+ * registered as logical sets. Logical sets share one physical set and take
+ * turns on air, each for a slice proportional to its weight. The controller
+ * ends each slice through the Enable duration, so no timer is needed here.
+ * Which logical set is on air is reported with onAdvertisingEnabled, and its
+ * data through onAdvertisingDataSet.
+ *
+ * The physical set is reserved while the controller still has sets free, as
+ * a set cannot be started once it has run out. It is kept while it is
+ * reserved or logical sets remain. If the reservation fails, enabled logical
+ * sets are disabled and told so through onAdvertisingEnabled.
+ */
+struct AdvMuxSet {
+  AdvertiseParameters params;
+  std::vector<uint8_t> adv_data;
+  std::vector<uint8_t> scan_resp;
+  uint8_t weight;
+  bool enabled;
+};
+
+static constexpr uint8_t kAdvMuxFirstLogicalId = 0x80;
+static constexpr uint8_t kAdvMuxLastLogicalId = 0xEF;
+static constexpr int kAdvMuxNone = -1;
+static constexpr int kAdvMuxStarting = -2;
+static constexpr uint8_t kAdvFailedTooManyAdvertisers = 0x02;
+static constexpr uint8_t kAdvFailedFeatureUnsupported = 0x05;
+
+// Serializes stack calls of the multiplexer so they reach the stack in the
+// order they were planned. Always acquired before sAdvMuxMutex, which is never
+// held across stack calls.
+static std::mutex sAdvMuxStackMutex;
+static std::mutex sAdvMuxMutex;
+static std::map<uint8_t, AdvMuxSet> sAdvMuxSets;
+static int sAdvMuxPhysicalId = kAdvMuxNone;
+static bool sAdvMuxReserved = false;
+static int sAdvMuxOnAir = kAdvMuxNone;
+static uint32_t sAdvMuxGeneration = 0;
+static uint32_t sAdvMuxSliceMs = 1000;
+
+static bool adv_mux_is_logical(int advertiser_id) {
+  return advertiser_id >= kAdvMuxFirstLogicalId &&
+         advertiser_id <= kAdvMuxLastLogicalId;
+}
+
+// Must be called with sAdvMuxMutex held.
+static int adv_mux_next_locked() {
+  if (sAdvMuxSets.empty()) return kAdvMuxNone;
+
+  auto it = sAdvMuxOnAir < 0 ? sAdvMuxSets.begin()
+                             : sAdvMuxSets.upper_bound(sAdvMuxOnAir);
+  for (size_t n = 0; n < sAdvMuxSets.size(); n++, it++) {
+    if (it == sAdvMuxSets.end()) it = sAdvMuxSets.begin();
+    if (it->second.enabled) return it->first;
+  }
+  return kAdvMuxNone;
+}
+
+// Enable duration in 10ms units; 0 keeps a lone logical set on air.
+static uint16_t adv_mux_duration_locked(const AdvMuxSet& set) {
+  int enabled = 0;
+  for (const auto& entry : sAdvMuxSets) enabled += entry.second.enabled;
+  if (enabled <= 1) return 0;
+
+  uint32_t duration = sAdvMuxSliceMs * set.weight / 10;
+  return std::min<uint32_t>(std::max<uint32_t>(duration, 1), 0xFFFF);
+}
+
+// Stack calls planned under sAdvMuxMutex, issued by adv_mux_apply().
+struct AdvMuxStep {
+  enum { kNone, kRegister, kUnregister, kDisable, kSwitch } action = kNone;
+  int physical = kAdvMuxNone;
+  uint32_t generation = 0;
+  int prev = kAdvMuxNone;
+  int next = kAdvMuxNone;
+  AdvMuxSet set = {};
+  uint16_t duration = 0;
+};
+
+static void adv_mux_status_cb(uint8_t status) {}
+
+static void adv_mux_off_air_cb(int prev, uint8_t status, int8_t tx_power) {
+  if (prev < 0) return;
+  {
+    std::lock_guard<std::mutex> lock(sAdvMuxMutex);
+    if (sAdvMuxSets.count(prev) == 0) return;
+  }
+  enableSetCb(prev, false, 0);
+}
+
+static void adv_mux_scan_resp_cb(uint8_t logical_id, uint8_t status) {
+  if (status != 0) {
+    callJniCallback(method_onScanResponseDataSet, logical_id, status);
+  }
+}
+
+static void adv_mux_switch_locked(AdvMuxStep* step);
+static void adv_mux_apply(const AdvMuxStep& step);
+
+static void adv_mux_slice_end(uint32_t generation) {
+  std::lock_guard<std::mutex> stack_lock(sAdvMuxStackMutex);
+  AdvMuxStep step;
+  {
+    std::lock_guard<std::mutex> lock(sAdvMuxMutex);
+    if (generation != sAdvMuxGeneration) return;
+    adv_mux_switch_locked(&step);
+  }
+  adv_mux_apply(step);
+}
+
+static void adv_mux_enable_timeout_cb(uint32_t generation, uint8_t status) {
+  adv_mux_slice_end(generation);
+}
+
+static void adv_mux_registered_cb(uint8_t advertiser_id, uint8_t status) {
+  std::vector<uint8_t> failed;
+  {
+    std::lock_guard<std::mutex> stack_lock(sAdvMuxStackMutex);
+    AdvMuxStep step;
+    {
+      std::lock_guard<std::mutex> lock(sAdvMuxMutex);
+      if (sAdvMuxPhysicalId != kAdvMuxStarting) {
+        // The multiplexer was shut down while the set was registering.
+        if (status == 0) {
+          step.action = AdvMuxStep::kUnregister;
+          step.physical = advertiser_id;
+        }
+      } else if (status != 0) {
+        sAdvMuxPhysicalId = kAdvMuxNone;
+        sAdvMuxOnAir = kAdvMuxNone;
+        for (auto& entry : sAdvMuxSets) {
+          if (!entry.second.enabled) continue;
+          entry.second.enabled = false;
+          failed.push_back(entry.first);
+        }
+      } else if (!sAdvMuxReserved && sAdvMuxSets.empty()) {
+        // Released while the set was registering.
+        sAdvMuxPhysicalId = kAdvMuxNone;
+        step.action = AdvMuxStep::kUnregister;
+        step.physical = advertiser_id;
+      } else {
+        sAdvMuxPhysicalId = advertiser_id;
+        adv_mux_switch_locked(&step);
+      }
+    }
+    adv_mux_apply(step);
+  }
+
+  if (status != 0) error("reserving a physical set failed: %d", status);
+  for (uint8_t logical_id : failed) enableSetCb(logical_id, false, status);
+}
+
+// Plans putting the next enabled logical set on air, or taking the physical
+// set off air and releasing it once it is no longer needed. Must be called
+// with sAdvMuxMutex held.
+static void adv_mux_switch_locked(AdvMuxStep* step) {
+  if (!sGattIf || sAdvMuxPhysicalId < 0) return;
+
+  step->generation = ++sAdvMuxGeneration;
+  step->prev = sAdvMuxOnAir;
+  step->next = adv_mux_next_locked();
+  sAdvMuxOnAir = step->next;
+  step->physical = sAdvMuxPhysicalId;
+
+  if (step->next < 0) {
+    if (!sAdvMuxReserved && sAdvMuxSets.empty()) {
+      step->action = AdvMuxStep::kUnregister;
+      sAdvMuxPhysicalId = kAdvMuxNone;
+    } else if (step->prev >= 0) {
+      step->action = AdvMuxStep::kDisable;
+    }
+    return;
+  }
+
+  step->set = sAdvMuxSets[step->next];
+  step->duration = adv_mux_duration_locked(step->set);
+  step->action = AdvMuxStep::kSwitch;
+}
+
+// Issues a planned step. Must be called with sAdvMuxStackMutex held and
+// sAdvMuxMutex released.
+static void adv_mux_apply(const AdvMuxStep& step) {
   if (!sGattIf) return;
 
-  jbyte* scan_resp_data = env->GetByteArrayElements(scan_resp, NULL);
-  uint16_t scan_resp_len = (uint16_t)env->GetArrayLength(scan_resp);
-  std::vector<uint8_t> scan_resp_vec(scan_resp_data,
-                                     scan_resp_data + scan_resp_len);
-  env->ReleaseByteArrayElements(scan_resp, scan_resp_data, JNI_ABORT);
+  switch (step.action) {
+    case AdvMuxStep::kNone:
+      return;
+
+    case AdvMuxStep::kRegister:
+      sGattIf->advertiser->RegisterAdvertiser(
+          base::Bind(&adv_mux_registered_cb));
+      return;
+
+    case AdvMuxStep::kUnregister:
+      sGattIf->advertiser->Unregister(step.physical);
+      return;
+
+    case AdvMuxStep::kDisable:
+      sGattIf->advertiser->Enable(step.physical, false,
+                                  base::Bind(&adv_mux_status_cb), 0, 0,
+                                  base::Bind(&adv_mux_status_cb));
+      return;
+
+    case AdvMuxStep::kSwitch: {
+      uint8_t physical = step.physical;
+      sGattIf->advertiser->Enable(physical, false,
+                                  base::Bind(&adv_mux_status_cb), 0, 0,
+                                  base::Bind(&adv_mux_status_cb));
+      sGattIf->advertiser->SetParameters(
+          physical, step.set.params,
+          base::Bind(&adv_mux_off_air_cb, step.prev));
+      sGattIf->advertiser->SetData(
+          physical, false, step.set.adv_data,
+          base::Bind(&callJniCallback, method_onAdvertisingDataSet,
+                     step.next));
+      sGattIf->advertiser->SetData(
+          physical, true, step.set.scan_resp,
+          base::Bind(&adv_mux_scan_resp_cb, step.next));
+      sGattIf->advertiser->Enable(
+          physical, true, base::Bind(&enableSetCb, step.next, true),
+          step.duration, 0,
+          base::Bind(&adv_mux_enable_timeout_cb, step.generation));
+      return;
+    }
+  }
+}
 
-  AdvertiseParameters params = parseParams(env, parameters);
-  PeriodicAdvertisingParameters periodicParams =
-      parsePeriodicParams(env, periodic_parameters);
+// Re-plans the schedule after a logical set was added, removed, enabled or
+// disabled. Must be called with sAdvMuxMutex held.
+static void adv_mux_reschedule_locked(bool on_air_changed, AdvMuxStep* step) {
+  if (sAdvMuxPhysicalId < 0) return;
+  if (sAdvMuxOnAir < 0 || on_air_changed) {
+    adv_mux_switch_locked(step);
+    return;
+  }
 
-  jbyte* adv_data_data = env->GetByteArrayElements(adv_data, NULL);
-  uint16_t adv_data_len = (uint16_t)env->GetArrayLength(adv_data);
-  std::vector<uint8_t> data_vec(adv_data_data, adv_data_data + adv_data_len);
-  env->ReleaseByteArrayElements(adv_data, adv_data_data, JNI_ABORT);
+  // A lone set was left on air without a slice end; start time slicing.
+  if (sAdvMuxOnAir >= 0 &&
+      adv_mux_duration_locked(sAdvMuxSets[sAdvMuxOnAir]) != 0) {
+    adv_mux_switch_locked(step);
+  }
+}
 
-  jbyte* periodic_data_data = env->GetByteArrayElements(periodic_data, NULL);
-  uint16_t periodic_data_len = (uint16_t)env->GetArrayLength(periodic_data);
-  std::vector<uint8_t> periodic_data_vec(
-      periodic_data_data, periodic_data_data + periodic_data_len);
-  env->ReleaseByteArrayElements(periodic_data, periodic_data_data, JNI_ABORT);
+static void adv_mux_shutdown() {
+  std::lock_guard<std::mutex> stack_lock(sAdvMuxStackMutex);
+  AdvMuxStep step;
+  {
+    std::lock_guard<std::mutex> lock(sAdvMuxMutex);
+    sAdvMuxSets.clear();
+    sAdvMuxReserved = false;
+    if (sAdvMuxPhysicalId >= 0) {
+      step.action = AdvMuxStep::kUnregister;
+      step.physical = sAdvMuxPhysicalId;
+    }
+    sAdvMuxPhysicalId = kAdvMuxNone;
+    sAdvMuxOnAir = kAdvMuxNone;
+    sAdvMuxGeneration++;
+  }
+  adv_mux_apply(step);
+}
+
+static jint startVirtualAdvertisingSetNative(JNIEnv* env, jobject object,
+                                             jintArray parameters,
+                                             jbyteArray adv_data,
+                                             jbyteArray scan_resp,
+                                             jint weight) {
+  if (!sGattIf) return -1;
+
+  AdvMuxSet set;
+  if (!parsePackedParams(env, parameters, &set.params)) return -1;
+  set.adv_data = toVector(env, adv_data);
+  set.scan_resp = toVector(env, scan_resp);
+  set.weight = std::min(std::max(weight, 1), 100);
+  set.enabled = true;
+
+  std::lock_guard<std::mutex> stack_lock(sAdvMuxStackMutex);
+  AdvMuxStep step;
+  int logical_id = -1;
+  {
+    std::lock_guard<std::mutex> lock(sAdvMuxMutex);
+    if (sAdvMuxPhysicalId == kAdvMuxNone) {
+      error("no physical advertising set reserved for logical sets");
+      return -1;
+    }
+    for (int id = kAdvMuxFirstLogicalId; id <= kAdvMuxLastLogicalId; id++) {
+      if (sAdvMuxSets.count(id)) continue;
+
+      adv_data_track(id, adv_data_initial_state(set.params, set.adv_data,
+                                                set.scan_resp));
+      sAdvMuxSets[id] = std::move(set);
+      adv_mux_reschedule_locked(false, &step);
+      logical_id = id;
+      break;
+    }
+  }
+
+  if (logical_id < 0) {
+    error("no logical advertising sets left");
+    return -1;
+  }
+  adv_mux_apply(step);
+  return logical_id;
+}
 
+static void setAdvertisingMuxSliceNative(JNIEnv* env, jobject object,
+                                         jint slice_ms) {
+  std::lock_guard<std::mutex> lock(sAdvMuxMutex);
+  sAdvMuxSliceMs = std::max(slice_ms, 10);
+}
+
+// Reserves a physical set for logical sets, or releases the reservation. A
+// released set is kept until its last logical set is stopped.
+static void setAdvertisingMuxReservedNative(JNIEnv* env, jobject object,
+                                            jboolean reserved) {
+  if (!sGattIf) return;
+
+  std::lock_guard<std::mutex> stack_lock(sAdvMuxStackMutex);
+  AdvMuxStep step;
+  {
+    std::lock_guard<std::mutex> lock(sAdvMuxMutex);
+    sAdvMuxReserved = reserved;
+    if (reserved && sAdvMuxPhysicalId == kAdvMuxNone) {
+      sAdvMuxPhysicalId = kAdvMuxStarting;
+      step.action = AdvMuxStep::kRegister;
+    } else if (!reserved && sAdvMuxPhysicalId >= 0 && sAdvMuxSets.empty()) {
+      step.action = AdvMuxStep::kUnregister;
+      step.physical = sAdvMuxPhysicalId;
+      sAdvMuxPhysicalId = kAdvMuxNone;
+      sAdvMuxOnAir = kAdvMuxNone;
+    }
+  }
+  adv_mux_apply(step);
+}
+
+static void adv_mux_stop(uint8_t logical_id) {
+  std::lock_guard<std::mutex> stack_lock(sAdvMuxStackMutex);
+  AdvMuxStep step;
+  {
+    std::lock_guard<std::mutex> lock(sAdvMuxMutex);
+    if (sAdvMuxSets.erase(logical_id) == 0) return;
+    adv_mux_reschedule_locked(sAdvMuxOnAir == logical_id, &step);
+  }
+  adv_mux_apply(step);
+}
+
+static void adv_mux_enable(JNIEnv* env, uint8_t logical_id, bool enable) {
+  uint8_t status = 0;
+  {
+    std::lock_guard<std::mutex> stack_lock(sAdvMuxStackMutex);
+    AdvMuxStep step;
+    {
+      std::lock_guard<std::mutex> lock(sAdvMuxMutex);
+      auto it = sAdvMuxSets.find(logical_id);
+      if (it == sAdvMuxSets.end()) return;
+
+      if (enable && sAdvMuxPhysicalId == kAdvMuxNone) {
+        // The reservation failed; there is no set to put this one on air.
+        status = kAdvFailedTooManyAdvertisers;
+      } else if (it->second.enabled != enable) {
+        it->second.enabled = enable;
+        adv_mux_reschedule_locked(!enable && sAdvMuxOnAir == logical_id,
+                                  &step);
+      }
+    }
+    adv_mux_apply(step);
+  }
+  env->CallVoidMethod(mAdvertiseCallbacksObj, method_onAdvertisingEnabled,
+                      logical_id, status == 0 && enable, status);
+}
+
+static void adv_mux_set_data(JNIEnv* env, uint8_t logical_id,
+                             bool scan_response, std::vector<uint8_t> data,
+                             uint32_t seq) {
+  jmethodID method = scan_response ? method_onScanResponseDataSet
+                                   : method_onAdvertisingDataSet;
+  AdvDataKind kind =
+      scan_response ? ADV_DATA_SCAN_RESPONSE : ADV_DATA_ADVERTISING;
+  {
+    std::lock_guard<std::mutex> stack_lock(sAdvMuxStackMutex);
+    int physical = kAdvMuxNone;
+    {
+      std::lock_guard<std::mutex> lock(sAdvMuxMutex);
+      auto it = sAdvMuxSets.find(logical_id);
+      if (it == sAdvMuxSets.end()) return;
+
+      (scan_response ? it->second.scan_resp : it->second.adv_data) = data;
+      if (sAdvMuxOnAir == logical_id) physical = sAdvMuxPhysicalId;
+    }
+    if (physical >= 0 && sGattIf) {
+      sGattIf->advertiser->SetData(
+          physical, scan_response, std::move(data),
+          base::Bind(&adv_data_set_cb, method, kind, seq, logical_id));
+      return;
+    }
+  }
+  // Applied when the set next goes on air; the stored copy is now current.
+  adv_data_on_set(logical_id, kind, seq, 0);
+  env->CallVoidMethod(mAdvertiseCallbacksObj, method, logical_id, 0);
+}
+
+// Parameters take effect from the logical set's next slice.
+static void adv_mux_set_params(JNIEnv* env, uint8_t logical_id,
+                               const AdvertiseParameters& params) {
+  {
+    std::lock_guard<std::mutex> lock(sAdvMuxMutex);
+    auto it = sAdvMuxSets.find(logical_id);
+    if (it == sAdvMuxSets.end()) return;
+    it->second.params = params;
+  }
+  env->CallVoidMethod(mAdvertiseCallbacksObj,
+                      method_onAdvertisingParametersUpdated, logical_id,
+                      params.tx_power, 0);
+}
+
+// Logical sets cannot carry periodic advertising.
+static void adv_mux_reject_periodic(JNIEnv* env, jmethodID method,
+                                    uint8_t logical_id) {
+  env->CallVoidMethod(mAdvertiseCallbacksObj, method, logical_id,
+                      kAdvFailedFeatureUnsupported);
+}
+
+static void startAdvertisingSetPackedNative(
+    JNIEnv* env, jobject object, jintArray parameters, jbyteArray adv_data,
+    jbyteArray scan_resp, jintArray periodic_parameters,
+    jbyteArray periodic_data, jint duration, jint maxExtAdvEvents,
+    jint reg_id) {
+  if (!sGattIf) return;
+
+  AdvertiseParameters params;
+  if (!parsePackedParams(env, parameters, &params)) {
+    env->CallVoidMethod(mAdvertiseCallbacksObj, method_onAdvertisingSetStarted,
+                        reg_id, 0, 0, kAdvFailedInternalError);
+    return;
+  }
+  PeriodicAdvertisingParameters periodicParams =
+      parsePackedPeriodicParams(env, periodic_parameters);
+  std::vector<uint8_t> data_vec = toVector(env, adv_data);
+  std::vector<uint8_t> scan_resp_vec = toVector(env, scan_resp);
+
+  adv_data_track_start(reg_id,
+                       adv_data_initial_state(params, data_vec, scan_resp_vec));
+  adv_metrics_start_begin(reg_id);
   sGattIf->advertiser->StartAdvertisingSet(
       base::Bind(&ble_advertising_set_started_cb, reg_id), params, data_vec,
-      scan_resp_vec, periodicParams, periodic_data_vec, duration,
+      scan_resp_vec, periodicParams, toVector(env, periodic_data), duration,
       maxExtAdvEvents, base::Bind(ble_advertising_set_timeout_cb));
 }
 
@@ -1848,6 +3325,12 @@ static void stopAdvertisingSetNative(JNIEnv* env, jobject object,
                                      jint advertiser_id) {
   if (!sGattIf) return;
 
+  adv_data_forget(advertiser_id);
+  adv_metrics_retire(advertiser_id);
+  if (adv_mux_is_logical(advertiser_id)) {
+    adv_mux_stop(advertiser_id);
+    return;
+  }
   sGattIf->advertiser->Unregister(advertiser_id);
 }
 
@@ -1865,8 +3348,16 @@ static void getOwnAddressCb(uint8_t advertiser_id, uint8_t address_type,
 static void getOwnAddressNative(JNIEnv* env, jobject object,
                                 jint advertiser_id) {
   if (!sGattIf) return;
+
+  int physical_id = advertiser_id;
+  if (adv_mux_is_logical(advertiser_id)) {
+    std::lock_guard<std::mutex> lock(sAdvMuxMutex);
+    physical_id = sAdvMuxPhysicalId;
+  }
+  if (physical_id < 0) return;
+
   sGattIf->advertiser->GetOwnAddress(
-      advertiser_id, base::Bind(&getOwnAddressCb, advertiser_id));
+      physical_id, base::Bind(&getOwnAddressCb, advertiser_id));
 }
 
 static void callJniCallback(jmethodID method, uint8_t advertiser_id,
@@ -1885,38 +3376,90 @@ static void enableSetCb(uint8_t advertiser_id, bool enable, uint8_t status) {
                                enable, status);
 }
 
+static void enableSetNativeCb(uint8_t advertiser_id, bool enable,
+                              uint8_t status) {
+  adv_metrics_end(advertiser_id, ADV_OP_ENABLE, status);
+  enableSetCb(advertiser_id, enable, status);
+}
+
+static void enableSetTimeoutCb(uint8_t advertiser_id, uint8_t status) {
+  adv_metrics_count(advertiser_id, ADV_OP_TIMEOUT, status);
+  enableSetCb(advertiser_id, false, status);
+}
+
 static void enableAdvertisingSetNative(JNIEnv* env, jobject object,
                                        jint advertiser_id, jboolean enable,
                                        jint duration, jint maxExtAdvEvents) {
   if (!sGattIf) return;
 
-  sGattIf->advertiser->Enable(advertiser_id, enable,
-                              base::Bind(&enableSetCb, advertiser_id, enable),
-                              duration, maxExtAdvEvents,
-                              base::Bind(&enableSetCb, advertiser_id, false));
+  if (adv_mux_is_logical(advertiser_id)) {
+    adv_mux_enable(env, advertiser_id, enable);
+    return;
+  }
+
+  adv_metrics_begin(advertiser_id, ADV_OP_ENABLE);
+  sGattIf->advertiser->Enable(
+      advertiser_id, enable,
+      base::Bind(&enableSetNativeCb, advertiser_id, enable), duration,
+      maxExtAdvEvents, base::Bind(&enableSetTimeoutCb, advertiser_id));
 }
 
 static void setAdvertisingDataNative(JNIEnv* env, jobject object,
                                      jint advertiser_id, jbyteArray data) {
   if (!sGattIf) return;
 
+  std::vector<uint8_t> data_vec = toVector(env, data);
+  uint8_t status;
+  uint32_t seq;
+  if (!adv_data_should_send(advertiser_id, ADV_DATA_ADVERTISING, data_vec,
+                            &status, &seq)) {
+    env->CallVoidMethod(mAdvertiseCallbacksObj, method_onAdvertisingDataSet,
+                        advertiser_id, status);
+    return;
+  }
+
+  if (adv_mux_is_logical(advertiser_id)) {
+    adv_mux_set_data(env, advertiser_id, false, std::move(data_vec), seq);
+    return;
+  }
+
+  adv_metrics_begin(advertiser_id, ADV_OP_DATA);
   sGattIf->advertiser->SetData(
-      advertiser_id, false, toVector(env, data),
-      base::Bind(&callJniCallback, method_onAdvertisingDataSet, advertiser_id));
+      advertiser_id, false, std::move(data_vec),
+      base::Bind(&adv_data_set_cb, method_onAdvertisingDataSet,
+                 ADV_DATA_ADVERTISING, seq, advertiser_id));
 }
 
 static void setScanResponseDataNative(JNIEnv* env, jobject object,
                                       jint advertiser_id, jbyteArray data) {
   if (!sGattIf) return;
 
+  std::vector<uint8_t> data_vec = toVector(env, data);
+  uint8_t status;
+  uint32_t seq;
+  if (!adv_data_should_send(advertiser_id, ADV_DATA_SCAN_RESPONSE, data_vec,
+                            &status, &seq)) {
+    env->CallVoidMethod(mAdvertiseCallbacksObj, method_onScanResponseDataSet,
+                        advertiser_id, status);
+    return;
+  }
+
+  if (adv_mux_is_logical(advertiser_id)) {
+    adv_mux_set_data(env, advertiser_id, true, std::move(data_vec), seq);
+    return;
+  }
+
+  adv_metrics_begin(advertiser_id, ADV_OP_SCAN_RESPONSE);
   sGattIf->advertiser->SetData(
-      advertiser_id, true, toVector(env, data),
-      base::Bind(&callJniCallback, method_onScanResponseDataSet,
-                 advertiser_id));
+      advertiser_id, true, std::move(data_vec),
+      base::Bind(&adv_data_set_cb, method_onScanResponseDataSet,
+                 ADV_DATA_SCAN_RESPONSE, seq, advertiser_id));
 }
 
 static void setAdvertisingParametersNativeCb(uint8_t advertiser_id,
                                              uint8_t status, int8_t tx_power) {
+  adv_metrics_end(advertiser_id, ADV_OP_PARAMETERS, status);
+
   CallbackEnv sCallbackEnv(__func__);
   if (!sCallbackEnv.valid()) return;
   sCallbackEnv->CallVoidMethod(mAdvertiseCallbacksObj,
@@ -1924,12 +3467,24 @@ static void setAdvertisingParametersNativeCb(uint8_t advertiser_id,
                                advertiser_id, tx_power, status);
 }
 
-static void setAdvertisingParametersNative(JNIEnv* env, jobject object,
-                                           jint advertiser_id,
-                                           jobject parameters) {
+static void setAdvertisingParametersPackedNative(JNIEnv* env, jobject object,
+                                                 jint advertiser_id,
+                                                 jintArray parameters) {
   if (!sGattIf) return;
 
-  AdvertiseParameters params = parseParams(env, parameters);
+  AdvertiseParameters params;
+  if (!parsePackedParams(env, parameters, &params)) {
+    env->CallVoidMethod(mAdvertiseCallbacksObj,
+                        method_onAdvertisingParametersUpdated, advertiser_id, 0,
+                        kAdvFailedInternalError);
+    return;
+  }
+  adv_data_set_params(advertiser_id, params);
+  if (adv_mux_is_logical(advertiser_id)) {
+    adv_mux_set_params(env, advertiser_id, params);
+    return;
+  }
+  adv_metrics_begin(advertiser_id, ADV_OP_PARAMETERS);
   sGattIf->advertiser->SetParameters(
       advertiser_id, params,
       base::Bind(&setAdvertisingParametersNativeCb, advertiser_id));
@@ -1940,11 +3495,18 @@ static void setPeriodicAdvertisingParametersNative(
     jobject periodic_parameters) {
   if (!sGattIf) return;
 
+  if (adv_mux_is_logical(advertiser_id)) {
+    adv_mux_reject_periodic(env, method_onPeriodicAdvertisingParametersUpdated,
+                            advertiser_id);
+    return;
+  }
+
   PeriodicAdvertisingParameters periodicParams =
       parsePeriodicParams(env, periodic_parameters);
+  adv_metrics_begin(advertiser_id, ADV_OP_PERIODIC_PARAMETERS);
   sGattIf->advertiser->SetPeriodicAdvertisingParameters(
       advertiser_id, periodicParams,
-      base::Bind(&callJniCallback,
+      base::Bind(&adv_op_cb, ADV_OP_PERIODIC_PARAMETERS,
                  method_onPeriodicAdvertisingParametersUpdated, advertiser_id));
 }
 
@@ -1953,14 +3515,27 @@ static void setPeriodicAdvertisingDataNative(JNIEnv* env, jobject object,
                                              jbyteArray data) {
   if (!sGattIf) return;
 
-  sGattIf->advertiser->SetPeriodicAdvertisingData(
-      advertiser_id, toVector(env, data),
-      base::Bind(&callJniCallback, method_onPeriodicAdvertisingDataSet,
-                 advertiser_id));
+  if (adv_mux_is_logical(advertiser_id)) {
+    adv_mux_reject_periodic(env, method_onPeriodicAdvertisingDataSet,
+                            advertiser_id);
+    return;
+  }
+
+  std::vector<uint8_t> data_vec = toVector(env, data);
+  uint8_t status;
+  if (!adv_data_check(advertiser_id, ADV_DATA_PERIODIC, data_vec, &status)) {
+    adv_periodic_data_report(env, advertiser_id, status, 1);
+    return;
+  }
+
+  if (!adv_periodic_stream_offer(advertiser_id, &data_vec)) return;
+  adv_periodic_data_write(env, advertiser_id, std::move(data_vec), 1);
 }
 
 static void enablePeriodicSetCb(uint8_t advertiser_id, bool enable,
                                 uint8_t status) {
+  adv_metrics_end(advertiser_id, ADV_OP_PERIODIC_ENABLE, status);
+
   CallbackEnv sCallbackEnv(__func__);
   if (!sCallbackEnv.valid()) return;
   sCallbackEnv->CallVoidMethod(mAdvertiseCallbacksObj,
@@ -1973,16 +3548,69 @@ static void setPeriodicAdvertisingEnableNative(JNIEnv* env, jobject object,
                                                jboolean enable) {
   if (!sGattIf) return;
 
+  if (adv_mux_is_logical(advertiser_id)) {
+    env->CallVoidMethod(mAdvertiseCallbacksObj,
+                        method_onPeriodicAdvertisingEnabled, advertiser_id,
+                        enable, kAdvFailedFeatureUnsupported);
+    return;
+  }
+
+  adv_metrics_begin(advertiser_id, ADV_OP_PERIODIC_ENABLE);
   sGattIf->advertiser->SetPeriodicAdvertisingEnable(
       advertiser_id, enable,
       base::Bind(&enablePeriodicSetCb, advertiser_id, enable));
 }
 
+void dump_advertising_metrics(int fd) {
+  std::lock_guard<std::mutex> lock(sAdvMetricsMutex);
+  dprintf(fd, "\nLE advertising metrics (latency buckets: <1ms, <2^i ms, "
+              "advertiser_id=%d: stopped sets)\n",
+          kAdvMetricsRetiredId);
+  adv_metrics_for_each_locked(
+      [fd](uint8_t advertiser_id, int op, const AdvOpStats& stats) {
+        dprintf(fd,
+                "  advertiser_id=%d %-15s count=%" PRIu64 " failures=%" PRIu64
+                " avg_us=%" PRIu64 " max_us=%" PRIu64 " buckets=",
+                advertiser_id, kAdvOpNames[op], stats.count, stats.failures,
+                stats.total_us / stats.count, stats.max_us);
+        for (size_t i = 0; i < kAdvLatencyBuckets; i++) {
+          dprintf(fd, "%s%u", i ? "," : "", stats.buckets[i]);
+        }
+        dprintf(fd, "\n");
+      });
+}
+
+// Record: advertiser_id u8, op u8, count, failures, total_us and max_us u64,
+// then the latency buckets as u32.
+bool dump_advertising_metrics_binary(int fd) {
+  std::lock_guard<std::mutex> lock(sAdvMetricsMutex);
+  uint32_t records = 0;
+  adv_metrics_for_each_locked(
+      [&records](uint8_t, int, const AdvOpStats&) { records++; });
+
+  DumpSectionWriter writer(fd, BT_DUMP_SECTION_ADV_METRICS,
+                           2 + 4 * 8 + 4 * kAdvLatencyBuckets, records);
+  adv_metrics_for_each_locked(
+      [&writer](uint8_t advertiser_id, int op, const AdvOpStats& stats) {
+        writer.put<uint8_t>(advertiser_id);
+        writer.put<uint8_t>(op);
+        writer.put<uint64_t>(stats.count);
+        writer.put<uint64_t>(stats.failures);
+        writer.put<uint64_t>(stats.total_us);
+        writer.put<uint64_t>(stats.max_us);
+        for (uint32_t bucket : stats.buckets) writer.put<uint32_t>(bucket);
+      });
+  return writer.finish();
+}
+
+static const JniMethod sPeriodicScanJavaMethods[] = {
+    {&method_onSyncStarted, "onSyncStarted", "(IIIILjava/lang/String;III)V"},
+    {&method_onSyncReport, "onSyncReport", "(IIII[B)V"},
+    {&method_onSyncLost, "onSyncLost", "(I)V"},
+};
+
 static void periodicScanClassInitNative(JNIEnv* env, jclass clazz) {
-  method_onSyncStarted =
-      env->GetMethodID(clazz, "onSyncStarted", "(IIIILjava/lang/String;III)V");
-  method_onSyncReport = env->GetMethodID(clazz, "onSyncReport", "(IIII[B)V");
-  method_onSyncLost = env->GetMethodID(clazz, "onSyncLost", "(I)V");
+  bindJniMethods(env, clazz, sPeriodicScanJavaMethods, "gatt periodic scan");
 }
 
 static void periodicScanInitializeNative(JNIEnv* env, jobject object) {
@@ -2082,19 +3710,22 @@ static JNINativeMethod sAdvertiseMethods[] = {
     {"classInitNative", "()V", (void*)advertiseClassInitNative},
     {"initializeNative", "()V", (void*)advertiseInitializeNative},
     {"cleanupNative", "()V", (void*)advertiseCleanupNative},
-    {"startAdvertisingSetNative",
-     "(Landroid/bluetooth/le/AdvertisingSetParameters;[B[BLandroid/bluetooth/"
-     "le/PeriodicAdvertisingParameters;[BIII)V",
-     (void*)startAdvertisingSetNative},
+    {"startAdvertisingSetPackedNative", "([I[B[B[I[BIII)V",
+     (void*)startAdvertisingSetPackedNative},
     {"getOwnAddressNative", "(I)V", (void*)getOwnAddressNative},
     {"stopAdvertisingSetNative", "(I)V", (void*)stopAdvertisingSetNative},
     {"enableAdvertisingSetNative", "(IZII)V",
      (void*)enableAdvertisingSetNative},
     {"setAdvertisingDataNative", "(I[B)V", (void*)setAdvertisingDataNative},
     {"setScanResponseDataNative", "(I[B)V", (void*)setScanResponseDataNative},
-    {"setAdvertisingParametersNative",
-     "(ILandroid/bluetooth/le/AdvertisingSetParameters;)V",
-     (void*)setAdvertisingParametersNative},
+    {"startVirtualAdvertisingSetNative", "([I[B[BI)I",
+     (void*)startVirtualAdvertisingSetNative},
+    {"setAdvertisingMuxSliceNative", "(I)V",
+     (void*)setAdvertisingMuxSliceNative},
+    {"setAdvertisingMuxReservedNative", "(Z)V",
+     (void*)setAdvertisingMuxReservedNative},
+    {"setAdvertisingParametersPackedNative", "(I[I)V",
+     (void*)setAdvertisingParametersPackedNative},
     {"setPeriodicAdvertisingParametersNative",
      "(ILandroid/bluetooth/le/PeriodicAdvertisingParameters;)V",
      (void*)setPeriodicAdvertisingParametersNative},
@@ -2210,10 +3841,12 @@ static JNINativeMethod sMethods[] = {
      (void*)gattServerStopServiceNative},
     {"gattServerDeleteServiceNative", "(II)V",
      (void*)gattServerDeleteServiceNative},
-    {"gattServerSendIndicationNative", "(III[B)V",
-     (void*)gattServerSendIndicationNative},
-    {"gattServerSendNotificationNative", "(III[B)V",
-     (void*)gattServerSendNotificationNative},
+    {"gattServerQueueNotificationNative", "(IIIZZZ[B)I",
+     (void*)gattServerQueueNotificationNative},
+    {"gattServerRestoreSubscriptionsNative", "(IZ)V",
+     (void*)gattServerRestoreSubscriptionsNative},
+    {"gattServerGetSubscriptionsNative", "()[I",
+     (void*)gattServerGetSubscriptionsNative},
     {"gattServerSendResponseNative", "(IIIIII[BI)V",
      (void*)gattServerSendResponseNative},
 
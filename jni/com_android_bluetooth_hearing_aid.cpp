@@ -90,12 +90,13 @@ class HearingAidCallbacksImpl : public HearingAidCallbacks {
 
 static HearingAidCallbacksImpl sHearingAidCallbacks;
 
-static void classInitNative(JNIEnv* env, jclass clazz) {
-  method_onConnectionStateChanged =
-      env->GetMethodID(clazz, "onConnectionStateChanged", "(I[B)V");
+static const JniMethod sJavaMethods[] = {
+    {&method_onConnectionStateChanged, "onConnectionStateChanged", "(I[B)V"},
+    {&method_onDeviceAvailable, "onDeviceAvailable", "(BJ[B)V"},
+};
 
-  method_onDeviceAvailable =
-      env->GetMethodID(clazz, "onDeviceAvailable", "(BJ[B)V");
+static void classInitNative(JNIEnv* env, jclass clazz) {
+  if (!bindJniMethods(env, clazz, sJavaMethods, "hearing_aid")) return;
 
   LOG(INFO) << __func__ << ": succeeds";
 }
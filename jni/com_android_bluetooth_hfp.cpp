@@ -403,35 +403,31 @@ class JniHeadsetCallbacks : bluetooth::headset::Callbacks {
   }
 };
 
+static const JniMethod sJavaMethods[] = {
+    {&method_onConnectionStateChanged, "onConnectionStateChanged", "(I[B)V"},
+    {&method_onAudioStateChanged, "onAudioStateChanged", "(I[B)V"},
+    {&method_onVrStateChanged, "onVrStateChanged", "(I[B)V"},
+    {&method_onAnswerCall, "onAnswerCall", "([B)V"},
+    {&method_onHangupCall, "onHangupCall", "([B)V"},
+    {&method_onVolumeChanged, "onVolumeChanged", "(II[B)V"},
+    {&method_onDialCall, "onDialCall", "(Ljava/lang/String;[B)V"},
+    {&method_onSendDtmf, "onSendDtmf", "(I[B)V"},
+    {&method_onNoiseReductionEnable, "onNoiseReductionEnable", "(Z[B)V"},
+    {&method_onWBS, "onWBS", "(I[B)V"},
+    {&method_onAtChld, "onAtChld", "(I[B)V"},
+    {&method_onAtCnum, "onAtCnum", "([B)V"},
+    {&method_onAtCind, "onAtCind", "([B)V"},
+    {&method_onAtCops, "onAtCops", "([B)V"},
+    {&method_onAtClcc, "onAtClcc", "([B)V"},
+    {&method_onUnknownAt, "onUnknownAt", "(Ljava/lang/String;[B)V"},
+    {&method_onKeyPressed, "onKeyPressed", "([B)V"},
+    {&method_onAtBind, "onATBind", "(Ljava/lang/String;[B)V"},
+    {&method_onAtBiev, "onATBiev", "(II[B)V"},
+    {&method_onAtBia, "onAtBia", "(ZZZZ[B)V"},
+};
+
 static void classInitNative(JNIEnv* env, jclass clazz) {
-  method_onConnectionStateChanged =
-      env->GetMethodID(clazz, "onConnectionStateChanged", "(I[B)V");
-  method_onAudioStateChanged =
-      env->GetMethodID(clazz, "onAudioStateChanged", "(I[B)V");
-  method_onVrStateChanged =
-      env->GetMethodID(clazz, "onVrStateChanged", "(I[B)V");
-  method_onAnswerCall = env->GetMethodID(clazz, "onAnswerCall", "([B)V");
-  method_onHangupCall = env->GetMethodID(clazz, "onHangupCall", "([B)V");
-  method_onVolumeChanged =
-      env->GetMethodID(clazz, "onVolumeChanged", "(II[B)V");
-  method_onDialCall =
-      env->GetMethodID(clazz, "onDialCall", "(Ljava/lang/String;[B)V");
-  method_onSendDtmf = env->GetMethodID(clazz, "onSendDtmf", "(I[B)V");
-  method_onNoiseReductionEnable =
-      env->GetMethodID(clazz, "onNoiseReductionEnable", "(Z[B)V");
-  method_onWBS = env->GetMethodID(clazz, "onWBS", "(I[B)V");
-  method_onAtChld = env->GetMethodID(clazz, "onAtChld", "(I[B)V");
-  method_onAtCnum = env->GetMethodID(clazz, "onAtCnum", "([B)V");
-  method_onAtCind = env->GetMethodID(clazz, "onAtCind", "([B)V");
-  method_onAtCops = env->GetMethodID(clazz, "onAtCops", "([B)V");
-  method_onAtClcc = env->GetMethodID(clazz, "onAtClcc", "([B)V");
-  method_onUnknownAt =
-      env->GetMethodID(clazz, "onUnknownAt", "(Ljava/lang/String;[B)V");
-  method_onKeyPressed = env->GetMethodID(clazz, "onKeyPressed", "([B)V");
-  method_onAtBind =
-      env->GetMethodID(clazz, "onATBind", "(Ljava/lang/String;[B)V");
-  method_onAtBiev = env->GetMethodID(clazz, "onATBiev", "(II[B)V");
-  method_onAtBia = env->GetMethodID(clazz, "onAtBia", "(ZZZZ[B)V");
+  if (!bindJniMethods(env, clazz, sJavaMethods, "hfp")) return;
 
   ALOGI("%s: succeeds", __func__);
 }
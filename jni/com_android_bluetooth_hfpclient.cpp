@@ -393,36 +393,33 @@ static bthf_client_callbacks_t sBluetoothHfpClientCallbacks = {
     ring_indication_cb,
 };
 
+static const JniMethod sJavaMethods[] = {
+    {&method_onConnectionStateChanged, "onConnectionStateChanged", "(III[B)V"},
+    {&method_onAudioStateChanged, "onAudioStateChanged", "(I[B)V"},
+    {&method_onVrStateChanged, "onVrStateChanged", "(I[B)V"},
+    {&method_onNetworkState, "onNetworkState", "(I[B)V"},
+    {&method_onNetworkRoaming, "onNetworkRoaming", "(I[B)V"},
+    {&method_onNetworkSignal, "onNetworkSignal", "(I[B)V"},
+    {&method_onBatteryLevel, "onBatteryLevel", "(I[B)V"},
+    {&method_onCurrentOperator, "onCurrentOperator", "(Ljava/lang/String;[B)V"},
+    {&method_onCall, "onCall", "(I[B)V"},
+    {&method_onCallSetup, "onCallSetup", "(I[B)V"},
+    {&method_onCallHeld, "onCallHeld", "(I[B)V"},
+    {&method_onRespAndHold, "onRespAndHold", "(I[B)V"},
+    {&method_onClip, "onClip", "(Ljava/lang/String;[B)V"},
+    {&method_onCallWaiting, "onCallWaiting", "(Ljava/lang/String;[B)V"},
+    {&method_onCurrentCalls, "onCurrentCalls", "(IIIILjava/lang/String;[B)V"},
+    {&method_onVolumeChange, "onVolumeChange", "(II[B)V"},
+    {&method_onCmdResult, "onCmdResult", "(II[B)V"},
+    {&method_onSubscriberInfo, "onSubscriberInfo", "(Ljava/lang/String;I[B)V"},
+    {&method_onInBandRing, "onInBandRing", "(I[B)V"},
+    {&method_onLastVoiceTagNumber, "onLastVoiceTagNumber",
+     "(Ljava/lang/String;[B)V"},
+    {&method_onRingIndication, "onRingIndication", "([B)V"},
+};
+
 static void classInitNative(JNIEnv* env, jclass clazz) {
-  method_onConnectionStateChanged =
-      env->GetMethodID(clazz, "onConnectionStateChanged", "(III[B)V");
-  method_onAudioStateChanged =
-      env->GetMethodID(clazz, "onAudioStateChanged", "(I[B)V");
-  method_onVrStateChanged =
-      env->GetMethodID(clazz, "onVrStateChanged", "(I[B)V");
-  method_onNetworkState = env->GetMethodID(clazz, "onNetworkState", "(I[B)V");
-  method_onNetworkRoaming = env->GetMethodID(clazz, "onNetworkRoaming", "(I[B)V");
-  method_onNetworkSignal = env->GetMethodID(clazz, "onNetworkSignal", "(I[B)V");
-  method_onBatteryLevel = env->GetMethodID(clazz, "onBatteryLevel", "(I[B)V");
-  method_onCurrentOperator =
-      env->GetMethodID(clazz, "onCurrentOperator", "(Ljava/lang/String;[B)V");
-  method_onCall = env->GetMethodID(clazz, "onCall", "(I[B)V");
-  method_onCallSetup = env->GetMethodID(clazz, "onCallSetup", "(I[B)V");
-  method_onCallHeld = env->GetMethodID(clazz, "onCallHeld", "(I[B)V");
-  method_onRespAndHold = env->GetMethodID(clazz, "onRespAndHold", "(I[B)V");
-  method_onClip = env->GetMethodID(clazz, "onClip", "(Ljava/lang/String;[B)V");
-  method_onCallWaiting =
-      env->GetMethodID(clazz, "onCallWaiting", "(Ljava/lang/String;[B)V");
-  method_onCurrentCalls =
-      env->GetMethodID(clazz, "onCurrentCalls", "(IIIILjava/lang/String;[B)V");
-  method_onVolumeChange = env->GetMethodID(clazz, "onVolumeChange", "(II[B)V");
-  method_onCmdResult = env->GetMethodID(clazz, "onCmdResult", "(II[B)V");
-  method_onSubscriberInfo =
-      env->GetMethodID(clazz, "onSubscriberInfo", "(Ljava/lang/String;I[B)V");
-  method_onInBandRing = env->GetMethodID(clazz, "onInBandRing", "(I[B)V");
-  method_onLastVoiceTagNumber =
-      env->GetMethodID(clazz, "onLastVoiceTagNumber", "(Ljava/lang/String;[B)V");
-  method_onRingIndication = env->GetMethodID(clazz, "onRingIndication", "([B)V");
+  if (!bindJniMethods(env, clazz, sJavaMethods, "hfpclient")) return;
 
   ALOGI("%s succeeds", __func__);
 }
@@ -153,19 +153,20 @@ static bthd_callbacks_t sHiddCb = {
     vc_unplug_callback,
 };
 
+static const JniMethod sJavaMethods[] = {
+    {&method_onApplicationStateChanged, "onApplicationStateChanged", "([BZ)V"},
+    {&method_onConnectStateChanged, "onConnectStateChanged", "([BI)V"},
+    {&method_onGetReport, "onGetReport", "(BBS)V"},
+    {&method_onSetReport, "onSetReport", "(BB[B)V"},
+    {&method_onSetProtocol, "onSetProtocol", "(B)V"},
+    {&method_onInterruptData, "onInterruptData", "(B[B)V"},
+    {&method_onVirtualCableUnplug, "onVirtualCableUnplug", "()V"},
+};
+
 static void classInitNative(JNIEnv* env, jclass clazz) {
   ALOGV("%s: done", __FUNCTION__);
 
-  method_onApplicationStateChanged =
-      env->GetMethodID(clazz, "onApplicationStateChanged", "([BZ)V");
-  method_onConnectStateChanged =
-      env->GetMethodID(clazz, "onConnectStateChanged", "([BI)V");
-  method_onGetReport = env->GetMethodID(clazz, "onGetReport", "(BBS)V");
-  method_onSetReport = env->GetMethodID(clazz, "onSetReport", "(BB[B)V");
-  method_onSetProtocol = env->GetMethodID(clazz, "onSetProtocol", "(B)V");
-  method_onInterruptData = env->GetMethodID(clazz, "onInterruptData", "(B[B)V");
-  method_onVirtualCableUnplug =
-      env->GetMethodID(clazz, "onVirtualCableUnplug", "()V");
+  if (!bindJniMethods(env, clazz, sJavaMethods, "hid_device")) return;
 }
 
 static void initNative(JNIEnv* env, jobject object) {
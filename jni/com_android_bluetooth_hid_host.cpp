@@ -184,15 +184,17 @@ static bthh_callbacks_t sBluetoothHidCallbacks = {
 
 // Define native functions
 
+static const JniMethod sJavaMethods[] = {
+    {&method_onConnectStateChanged, "onConnectStateChanged", "([BI)V"},
+    {&method_onGetProtocolMode, "onGetProtocolMode", "([BI)V"},
+    {&method_onGetReport, "onGetReport", "([B[BI)V"},
+    {&method_onHandshake, "onHandshake", "([BI)V"},
+    {&method_onVirtualUnplug, "onVirtualUnplug", "([BI)V"},
+    {&method_onGetIdleTime, "onGetIdleTime", "([BI)V"},
+};
+
 static void classInitNative(JNIEnv* env, jclass clazz) {
-  method_onConnectStateChanged =
-      env->GetMethodID(clazz, "onConnectStateChanged", "([BI)V");
-  method_onGetProtocolMode =
-      env->GetMethodID(clazz, "onGetProtocolMode", "([BI)V");
-  method_onGetReport = env->GetMethodID(clazz, "onGetReport", "([B[BI)V");
-  method_onHandshake = env->GetMethodID(clazz, "onHandshake", "([BI)V");
-  method_onVirtualUnplug = env->GetMethodID(clazz, "onVirtualUnplug", "([BI)V");
-  method_onGetIdleTime = env->GetMethodID(clazz, "onGetIdleTime", "([BI)V");
+  if (!bindJniMethods(env, clazz, sJavaMethods, "hid_host")) return;
 
   ALOGI("%s: succeeds", __func__);
 }
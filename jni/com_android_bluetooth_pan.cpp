@@ -102,11 +102,14 @@ static btpan_callbacks_t sBluetoothPanCallbacks = {
 
 // Define native functions
 
+static const JniMethod sJavaMethods[] = {
+    {&method_onConnectStateChanged, "onConnectStateChanged", "([BIIII)V"},
+    {&method_onControlStateChanged, "onControlStateChanged",
+     "(IIILjava/lang/String;)V"},
+};
+
 static void classInitNative(JNIEnv* env, jclass clazz) {
-  method_onConnectStateChanged =
-      env->GetMethodID(clazz, "onConnectStateChanged", "([BIIII)V");
-  method_onControlStateChanged = env->GetMethodID(
-      clazz, "onControlStateChanged", "(IIILjava/lang/String;)V");
+  if (!bindJniMethods(env, clazz, sJavaMethods, "pan")) return;
 
   info("succeeds");
 }
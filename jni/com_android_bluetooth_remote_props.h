@@ -0,0 +1,128 @@
+/*
+ * Copyright 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <base/macros.h>
+#include <hardware/bluetooth.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <list>
+#include <map>
+#include <mutex>
+#include <vector>
+
+namespace android {
+
+#define REMOTE_PROPS_ALL (-1)
+
+/* Remote device properties last delivered to Java, for the most recently
+ * reported devices. Property updates only carry what changed since then.
+ * Forgetting a device or a property makes its next report go through in
+ * full, which is also what happens to devices evicted from the cache. */
+class RemotePropsCache {
+ public:
+  explicit RemotePropsCache(size_t max_devices) : max_devices_(max_devices) {}
+
+  /* Forgets property |type| of |bd_addr|, or all of its properties with
+   * REMOTE_PROPS_ALL. A null |bd_addr| forgets every device. */
+  void forget(const RawAddress* bd_addr, int type) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!bd_addr) {
+      devices_.clear();
+      lru_.clear();
+      return;
+    }
+
+    auto it = devices_.find(*bd_addr);
+    if (it == devices_.end()) return;
+
+    if (type != REMOTE_PROPS_ALL) {
+      it->second.values.erase(type);
+      return;
+    }
+    lru_.erase(it->second.lru);
+    devices_.erase(it);
+  }
+
+  /* Java rebuilds its view of a device across pairing, and the stack
+   * re-reports UUIDs and alias after it, so every bond state transition
+   * starts the device over. */
+  void onBondStateChanged(const RawAddress& bd_addr) {
+    forget(&bd_addr, REMOTE_PROPS_ALL);
+  }
+
+  /* Returns the properties of a property update that differ from what was
+   * last delivered for |bd_addr|, and remembers them. */
+  std::vector<bt_property_t> filter(const RawAddress& bd_addr,
+                                    int num_properties,
+                                    bt_property_t* properties) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = devices_.find(bd_addr);
+    if (it == devices_.end()) {
+      if (devices_.size() >= max_devices_) {
+        devices_.erase(lru_.back());
+        lru_.pop_back();
+      }
+      lru_.push_front(bd_addr);
+      it = devices_.emplace(bd_addr, Device()).first;
+      it->second.lru = lru_.begin();
+    } else if (it->second.lru != lru_.begin()) {
+      lru_.splice(lru_.begin(), lru_, it->second.lru);
+    }
+
+    std::vector<bt_property_t> changed;
+    for (int i = 0; i < num_properties; i++) {
+      const uint8_t* val = (const uint8_t*)properties[i].val;
+      std::vector<uint8_t> bytes(val, val + properties[i].len);
+      auto last = it->second.values.find(properties[i].type);
+      if (last != it->second.values.end() && last->second == bytes) continue;
+
+      it->second.values[properties[i].type] = std::move(bytes);
+      changed.push_back(properties[i]);
+    }
+    delivered_ += changed.size();
+    suppressed_ += num_properties - changed.size();
+    return changed;
+  }
+
+  void dump(int fd) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    dprintf(fd,
+            "\nRemote device property cache: %zu devices, %llu properties "
+            "delivered, %llu unchanged suppressed\n",
+            devices_.size(), (unsigned long long)delivered_,
+            (unsigned long long)suppressed_);
+  }
+
+ private:
+  struct Device {
+    std::map<int, std::vector<uint8_t>> values;
+    std::list<RawAddress>::iterator lru;
+  };
+
+  const size_t max_devices_;
+  std::mutex mutex_;
+  std::map<RawAddress, Device> devices_;
+  // Most recently reported device first.
+  std::list<RawAddress> lru_;
+  uint64_t delivered_ = 0;
+  uint64_t suppressed_ = 0;
+
+  DISALLOW_COPY_AND_ASSIGN(RemotePropsCache);
+};
+
+}  // namespace android
@@ -76,27 +76,28 @@ static void initializeNative(JNIEnv* env, jobject object) {
   sCallbacksObj = env->NewGlobalRef(object);
 }
 
+static const JniMethod sJavaMethods[] = {
+    /* generic SDP record (raw data)*/
+    {&method_sdpRecordFoundCallback, "sdpRecordFoundCallback", "(I[B[BI[B)V"},
+    /* MAS SDP record*/
+    {&method_sdpMasRecordFoundCallback, "sdpMasRecordFoundCallback",
+     "(I[B[BIIIIIILjava/lang/String;Z)V"},
+    /* MNS SDP record*/
+    {&method_sdpMnsRecordFoundCallback, "sdpMnsRecordFoundCallback",
+     "(I[B[BIIIILjava/lang/String;Z)V"},
+    /* PBAP PSE record */
+    {&method_sdpPseRecordFoundCallback, "sdpPseRecordFoundCallback",
+     "(I[B[BIIIIILjava/lang/String;Z)V"},
+    /* OPP Server record */
+    {&method_sdpOppOpsRecordFoundCallback, "sdpOppOpsRecordFoundCallback",
+     "(I[B[BIIILjava/lang/String;[BZ)V"},
+    /* SAP Server record */
+    {&method_sdpSapsRecordFoundCallback, "sdpSapsRecordFoundCallback",
+     "(I[B[BIILjava/lang/String;Z)V"},
+};
+
 static void classInitNative(JNIEnv* env, jclass clazz) {
-  /* generic SDP record (raw data)*/
-  method_sdpRecordFoundCallback =
-      env->GetMethodID(clazz, "sdpRecordFoundCallback", "(I[B[BI[B)V");
-
-  /* MAS SDP record*/
-  method_sdpMasRecordFoundCallback = env->GetMethodID(
-      clazz, "sdpMasRecordFoundCallback", "(I[B[BIIIIIILjava/lang/String;Z)V");
-  /* MNS SDP record*/
-  method_sdpMnsRecordFoundCallback = env->GetMethodID(
-      clazz, "sdpMnsRecordFoundCallback", "(I[B[BIIIILjava/lang/String;Z)V");
-  /* PBAP PSE record */
-  method_sdpPseRecordFoundCallback = env->GetMethodID(
-      clazz, "sdpPseRecordFoundCallback", "(I[B[BIIIIILjava/lang/String;Z)V");
-  /* OPP Server record */
-  method_sdpOppOpsRecordFoundCallback =
-      env->GetMethodID(clazz, "sdpOppOpsRecordFoundCallback",
-                       "(I[B[BIIILjava/lang/String;[BZ)V");
-  /* SAP Server record */
-  method_sdpSapsRecordFoundCallback = env->GetMethodID(
-      clazz, "sdpSapsRecordFoundCallback", "(I[B[BIILjava/lang/String;Z)V");
+  if (!bindJniMethods(env, clazz, sJavaMethods, "sdp")) return;
 }
 
 static jboolean sdpSearchNative(JNIEnv* env, jobject obj, jbyteArray address,
@@ -21,7 +21,13 @@
 #include <binder/IPCThreadState.h>
 #include <binder/IServiceManager.h>
 #include <pwd.h>
+#include <stdio.h>
 #include <sys/types.h>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
 #include "IUserManager.h"
 
 using ::android::binder::Status;
@@ -34,19 +40,150 @@ uid_t systemUiUid;
 static uid_t SYSTEM_UID = 1000;
 constexpr int PER_USER_RANGE = 100000;
 
-Status checkPermission(const char* permission) {
-  int32_t pid;
-  int32_t uid;
+// Profile parent of each user seen by isCallerActiveUserOrManagedProfile(),
+// and the user service it was looked up from.
+static constexpr size_t kProfileParentsMax = 32;
+static std::mutex profileParentsMutex;
+static std::map<uid_t, uid_t> profileParents;
+static sp<IUserManager> userManager;
+
+class UserManagerDeathRecipient : public IBinder::DeathRecipient {
+ public:
+  void binderDied(const wp<IBinder>& who) override {
+    LOG(WARNING) << "User service died, dropping profile parents";
+    clearProfileParentCache();
+  }
+};
 
-  if (android::checkCallingPermission(String16(permission), &pid, &uid)) {
-    return Status::ok();
+static sp<UserManagerDeathRecipient> userManagerDeathRecipient;
+
+void clearProfileParentCache() {
+  std::lock_guard<std::mutex> lock(profileParentsMutex);
+  profileParents.clear();
+  if (userManager != NULL && userManagerDeathRecipient != NULL) {
+    IInterface::asBinder(userManager)->unlinkToDeath(userManagerDeathRecipient);
+  }
+  userManager = NULL;
+}
+
+static sp<IUserManager> getUserManagerLocked() {
+  if (userManager != NULL) return userManager;
+
+  sp<IServiceManager> sm = defaultServiceManager();
+  sp<IBinder> binder = sm->getService(String16("user"));
+  if (binder == NULL) return NULL;
+
+  if (userManagerDeathRecipient == NULL) {
+    userManagerDeathRecipient = new UserManagerDeathRecipient();
+  }
+  if (binder->linkToDeath(userManagerDeathRecipient) != NO_ERROR) {
+    // Without a death notification the cache could go stale; don't keep it.
+    return interface_cast<IUserManager>(binder);
+  }
+  userManager = interface_cast<IUserManager>(binder);
+  return userManager;
+}
+
+// Returns the profile parent of |user|, or |user| if it can't be looked up.
+static uid_t getProfileParent(IPCThreadState* ipcState, uid_t user) {
+  std::lock_guard<std::mutex> lock(profileParentsMutex);
+  auto it = profileParents.find(user);
+  if (it != profileParents.end()) return it->second;
+
+  sp<IUserManager> um = getUserManagerLocked();
+  if (um == NULL) return user;
+
+  // Must use Bluetooth process identity when making call to get parent user
+  int64_t ident = ipcState->clearCallingIdentity();
+  int32_t parent = um->getProfileParentId(user);
+  ipcState->restoreCallingIdentity(ident);
+  if (parent < 0) return user;
+
+  if (userManager != NULL) {
+    if (profileParents.size() >= kProfileParentsMax) profileParents.clear();
+    profileParents[user] = parent;
   }
+  return parent;
+}
 
+/* Results of recent permission checks by caller UID. Entries expire after a
+ * short TTL, so a grant or revocation takes effect within that time; there
+ * is no native notification for permission changes to listen to. */
+static constexpr std::chrono::milliseconds kPermissionCacheTtl(1000);
+static constexpr size_t kPermissionCacheMax = 128;
+
+struct PermissionCacheEntry {
+  bool granted;
+  std::chrono::steady_clock::time_point expires;
+};
+
+static std::mutex permissionCacheMutex;
+static std::map<std::pair<uid_t, std::string>, PermissionCacheEntry>
+    permissionCache;
+static uint64_t permissionCacheHits;
+static uint64_t permissionCacheMisses;
+
+void clearPermissionCache() {
+  std::lock_guard<std::mutex> lock(permissionCacheMutex);
+  permissionCache.clear();
+}
+
+void dumpPermissionCache(int fd) {
+  std::lock_guard<std::mutex> lock(permissionCacheMutex);
+  dprintf(fd,
+          "\nPermission check cache: %zu entries, %llu hits, %llu misses\n",
+          permissionCache.size(), (unsigned long long)permissionCacheHits,
+          (unsigned long long)permissionCacheMisses);
+}
+
+static Status permissionDenied(int32_t pid, int32_t uid,
+                               const char* permission) {
   auto err = ::base::StringPrintf("UID %d / PID %d lacks permission %s", uid,
                                   pid, permission);
   return Status::fromExceptionCode(Status::EX_SECURITY, String8(err.c_str()));
 }
 
+Status checkPermission(const char* permission) {
+  int32_t pid;
+  int32_t uid = IPCThreadState::self()->getCallingUid();
+  auto key = std::make_pair((uid_t)uid, std::string(permission));
+  auto now = std::chrono::steady_clock::now();
+
+  {
+    std::lock_guard<std::mutex> lock(permissionCacheMutex);
+    auto it = permissionCache.find(key);
+    if (it != permissionCache.end() && it->second.expires > now) {
+      permissionCacheHits++;
+      if (it->second.granted) return Status::ok();
+      return permissionDenied(IPCThreadState::self()->getCallingPid(), uid,
+                              permission);
+    }
+    permissionCacheMisses++;
+  }
+
+  bool granted =
+      android::checkCallingPermission(String16(permission), &pid, &uid);
+  {
+    std::lock_guard<std::mutex> lock(permissionCacheMutex);
+    if (permissionCache.size() >= kPermissionCacheMax) {
+      for (auto it = permissionCache.begin(); it != permissionCache.end();) {
+        it = it->second.expires > now ? std::next(it)
+                                      : permissionCache.erase(it);
+      }
+      if (permissionCache.size() >= kPermissionCacheMax) {
+        permissionCache.clear();
+      }
+    }
+    permissionCache[key] = {granted, now + kPermissionCacheTtl};
+  }
+
+  if (granted) {
+    return Status::ok();
+  }
+
+  return permissionDenied(pid, uid, permission);
+}
+
 bool isCallerActiveUser() {
   IPCThreadState* ipcState = IPCThreadState::selfOrNull();
   if (!ipcState) return true;  // It's a local call
@@ -71,19 +208,7 @@ bool isCallerActiveUserOrManagedProfile() {
       (SYSTEM_UID == callingUid))
     return true;
 
-  uid_t parentUser = callingUser;
-
-  sp<IServiceManager> sm = defaultServiceManager();
-  sp<IBinder> binder = sm->getService(String16("user"));
-  sp<IUserManager> um = interface_cast<IUserManager>(binder);
-  if (um != NULL) {
-    // Must use Bluetooth process identity when making call to get parent user
-    int64_t ident = ipcState->clearCallingIdentity();
-    parentUser = um->getProfileParentId(callingUser);
-    ipcState->restoreCallingIdentity(ident);
-  }
-
-  return foregroundUserId == parentUser;
+  return foregroundUserId == getProfileParent(ipcState, callingUser);
 }
 
 }  // namespace bluetooth
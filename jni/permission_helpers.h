@@ -32,6 +32,13 @@ android::binder::Status checkPermission(const char* permission);
 bool isCallerActiveUser();
 bool isCallerActiveUserOrManagedProfile();
 
+// Drops the cached profile parents and user service, e.g. on a user switch.
+void clearProfileParentCache();
+
+// Drops the cached results of checkPermission().
+void clearPermissionCache();
+void dumpPermissionCache(int fd);
+
 }  // namespace bluetooth
 }  // namespace android
 
@@ -0,0 +1,78 @@
+/*
+ * Copyright 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+
+#include "com_android_bluetooth_remote_props.h"
+
+namespace android {
+
+static const RawAddress kDevice = {{0x00, 0x11, 0x22, 0x33, 0x44, 0x55}};
+
+class RemotePropsCacheTest : public ::testing::Test {
+ protected:
+  RemotePropsCacheTest() : cache_(4) {}
+
+  // Reports the device's UUIDs and alias, as the stack does after pairing,
+  // and returns the types that were let through.
+  std::vector<int> ReportUuidsAndAlias() {
+    bt_property_t properties[] = {
+        {BT_PROPERTY_UUIDS, sizeof(uuids_), uuids_},
+        {BT_PROPERTY_REMOTE_FRIENDLY_NAME, sizeof(alias_), alias_},
+    };
+    std::vector<int> types;
+    for (const bt_property_t& property :
+         cache_.filter(kDevice, 2, properties)) {
+      types.push_back(property.type);
+    }
+    return types;
+  }
+
+  RemotePropsCache cache_;
+  uint8_t uuids_[16] = {0x00, 0x00, 0x11, 0x0b};
+  char alias_[6] = "phone";
+};
+
+TEST_F(RemotePropsCacheTest, unchangedPropertiesAreSuppressed) {
+  EXPECT_EQ(2u, ReportUuidsAndAlias().size());
+  EXPECT_TRUE(ReportUuidsAndAlias().empty());
+}
+
+TEST_F(RemotePropsCacheTest, unpairThenRepairDeliversPropertiesAgain) {
+  cache_.onBondStateChanged(kDevice);  // BONDING
+  cache_.onBondStateChanged(kDevice);  // BONDED
+  EXPECT_EQ(2u, ReportUuidsAndAlias().size());
+
+  cache_.onBondStateChanged(kDevice);  // BOND_NONE
+  cache_.onBondStateChanged(kDevice);  // BONDING
+  cache_.onBondStateChanged(kDevice);  // BONDED
+  std::vector<int> types = ReportUuidsAndAlias();
+  ASSERT_EQ(2u, types.size());
+  EXPECT_EQ(BT_PROPERTY_UUIDS, types[0]);
+  EXPECT_EQ(BT_PROPERTY_REMOTE_FRIENDLY_NAME, types[1]);
+}
+
+TEST_F(RemotePropsCacheTest, leastRecentlyReportedDeviceIsEvicted) {
+  EXPECT_EQ(2u, ReportUuidsAndAlias().size());
+  for (uint8_t i = 1; i <= 4; i++) {
+    RawAddress other = {{0x00, 0x00, 0x00, 0x00, 0x00, i}};
+    bt_property_t property = {BT_PROPERTY_UUIDS, sizeof(uuids_), uuids_};
+    EXPECT_EQ(1u, cache_.filter(other, 1, &property).size());
+  }
+  EXPECT_EQ(2u, ReportUuidsAndAlias().size());
+}
+
+}  // namespace android
@@ -167,10 +167,17 @@ public final class Utils {
     }
 
     public static ParcelUuid[] byteArrayToUuid(byte[] val) {
-        int numUuids = val.length / BD_UUID_LEN;
+        return byteArrayToUuid(val, 0, val.length);
+    }
+
+    /**
+     * Converts the {@code length} bytes of {@code val} starting at {@code start} into UUIDs.
+     */
+    public static ParcelUuid[] byteArrayToUuid(byte[] val, int start, int length) {
+        int numUuids = length / BD_UUID_LEN;
         ParcelUuid[] puuids = new ParcelUuid[numUuids];
         UUID uuid;
-        int offset = 0;
+        int offset = start;
 
         ByteBuffer converter = ByteBuffer.wrap(val);
         converter.order(ByteOrder.BIG_ENDIAN);
@@ -29,6 +29,7 @@ import android.util.Log;
 import java.util.List;
 
 import com.android.bluetooth.Utils;
+import com.android.bluetooth.btservice.AdapterService;
 import com.android.internal.annotations.GuardedBy;
 import com.android.internal.annotations.VisibleForTesting;
 
@@ -45,6 +46,7 @@ public class A2dpNativeInterface {
     private static final Object INSTANCE_LOCK = new Object();
 
     static {
+        AdapterService.registerProfileNatives("a2dp");
         classInitNative();
     }
 
@@ -51,6 +51,7 @@ public class A2dpSinkService extends ProfileService {
     private static A2dpSinkService sService;
 
     static {
+        AdapterService.registerProfileNatives("a2dp_sink");
         classInitNative();
     }
 
@@ -20,6 +20,8 @@ import android.bluetooth.BluetoothAdapter;
 import android.bluetooth.BluetoothDevice;
 import android.util.Log;
 
+import com.android.bluetooth.btservice.AdapterService;
+
 import java.util.List;
 
 /**
@@ -34,6 +36,7 @@ public class AvrcpNativeInterface {
     private AvrcpTargetService mAvrcpService;
 
     static {
+        AdapterService.registerProfileNatives("avrcp_target");
         classInitNative();
     }
 
@@ -29,6 +29,7 @@ import android.os.Bundle;
 import android.util.Log;
 
 import com.android.bluetooth.Utils;
+import com.android.bluetooth.btservice.AdapterService;
 import com.android.bluetooth.btservice.ProfileService;
 
 import java.util.ArrayList;
@@ -98,6 +99,7 @@ public class AvrcpControllerService extends ProfileService {
             new ConcurrentHashMap<>(1);
 
     static {
+        AdapterService.registerProfileNatives("avrcp_controller");
         classInitNative();
     }
 
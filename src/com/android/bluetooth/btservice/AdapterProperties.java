@@ -767,18 +767,24 @@ class AdapterProperties {
         }
     }
 
-    void adapterPropertyChangedCallback(int[] types, byte[][] values) {
+    /**
+     * Applies adapter properties packed by the native layer; see {@link JniCallbacks}. Values
+     * are read in place, and only the ones kept are copied out of {@code packed}.
+     */
+    void adapterPropertyChangedCallback(byte[] packed, int[] offsets) {
         Intent intent;
         int type;
-        byte[] val;
-        for (int i = 0; i < types.length; i++) {
-            val = values[i];
-            type = types[i];
-            infoLog("adapterPropertyChangedCallback with type:" + type + " len:" + val.length);
+        int off;
+        int len;
+        for (int i = 0; i < offsets.length; i++) {
+            type = JniCallbacks.propertyType(packed, offsets[i]);
+            off = JniCallbacks.propertyValueOffset(offsets[i]);
+            len = JniCallbacks.propertyValueLength(packed, offsets[i]);
+            infoLog("adapterPropertyChangedCallback with type:" + type + " len:" + len);
             synchronized (mObject) {
                 switch (type) {
                     case AbstractionLayer.BT_PROPERTY_BDNAME:
-                        mName = new String(val);
+                        mName = new String(packed, off, len);
                         intent = new Intent(BluetoothAdapter.ACTION_LOCAL_NAME_CHANGED);
                         intent.putExtra(BluetoothAdapter.EXTRA_LOCAL_NAME, mName);
                         intent.addFlags(Intent.FLAG_RECEIVER_REGISTERED_ONLY_BEFORE_BOOT);
@@ -787,7 +793,7 @@ class AdapterProperties {
                         debugLog("Name is: " + mName);
                         break;
                     case AbstractionLayer.BT_PROPERTY_BDADDR:
-                        mAddress = val;
+                        mAddress = JniCallbacks.copyPropertyValue(packed, offsets[i]);
                         String address = Utils.getAddressStringFromByte(mAddress);
                         debugLog("Address is:" + address);
                         intent = new Intent(BluetoothAdapter.ACTION_BLUETOOTH_ADDRESS_CHANGED);
@@ -797,19 +803,19 @@ class AdapterProperties {
                                 AdapterService.BLUETOOTH_PERM);
                         break;
                     case AbstractionLayer.BT_PROPERTY_CLASS_OF_DEVICE:
-                        if (val == null || val.length != 3) {
+                        if (len != 3) {
                             debugLog("Invalid BT CoD value from stack.");
                             return;
                         }
-                        int bluetoothClass =
-                                ((int) val[0] << 16) + ((int) val[1] << 8) + (int) val[2];
+                        int bluetoothClass = ((int) packed[off] << 16)
+                                + ((int) packed[off + 1] << 8) + (int) packed[off + 2];
                         if (bluetoothClass != 0) {
                             mBluetoothClass = new BluetoothClass(bluetoothClass);
                         }
                         debugLog("BT Class:" + mBluetoothClass);
                         break;
                     case AbstractionLayer.BT_PROPERTY_ADAPTER_SCAN_MODE:
-                        int mode = Utils.byteArrayToInt(val, 0);
+                        int mode = Utils.byteArrayToInt(packed, off);
                         mScanMode = AdapterService.convertScanModeFromHal(mode);
                         intent = new Intent(BluetoothAdapter.ACTION_SCAN_MODE_CHANGED);
                         intent.putExtra(BluetoothAdapter.EXTRA_SCAN_MODE, mScanMode);
@@ -818,34 +824,35 @@ class AdapterProperties {
                         debugLog("Scan Mode:" + mScanMode);
                         break;
                     case AbstractionLayer.BT_PROPERTY_UUIDS:
-                        mUuids = Utils.byteArrayToUuid(val);
+                        mUuids = Utils.byteArrayToUuid(packed, off, len);
                         break;
                     case AbstractionLayer.BT_PROPERTY_ADAPTER_BONDED_DEVICES:
-                        int number = val.length / BD_ADDR_LEN;
+                        int number = len / BD_ADDR_LEN;
                         byte[] addrByte = new byte[BD_ADDR_LEN];
                         for (int j = 0; j < number; j++) {
-                            System.arraycopy(val, j * BD_ADDR_LEN, addrByte, 0, BD_ADDR_LEN);
+                            System.arraycopy(packed, off + j * BD_ADDR_LEN, addrByte, 0,
+                                    BD_ADDR_LEN);
                             onBondStateChanged(mAdapter.getRemoteDevice(
                                     Utils.getAddressStringFromByte(addrByte)),
                                     BluetoothDevice.BOND_BONDED);
                         }
                         break;
                     case AbstractionLayer.BT_PROPERTY_ADAPTER_DISCOVERABLE_TIMEOUT:
-                        mDiscoverableTimeout = Utils.byteArrayToInt(val, 0);
+                        mDiscoverableTimeout = Utils.byteArrayToInt(packed, off);
                         debugLog("Discoverable Timeout:" + mDiscoverableTimeout);
                         break;
 
                     case AbstractionLayer.BT_PROPERTY_LOCAL_LE_FEATURES:
-                        updateFeatureSupport(val);
+                        updateFeatureSupport(packed, off);
                         break;
 
                     case AbstractionLayer.BT_PROPERTY_LOCAL_IO_CAPS:
-                        mLocalIOCapability = Utils.byteArrayToInt(val);
+                        mLocalIOCapability = Utils.byteArrayToInt(packed, off);
                         debugLog("mLocalIOCapability set to " + mLocalIOCapability);
                         break;
 
                     case AbstractionLayer.BT_PROPERTY_LOCAL_IO_CAPS_BLE:
-                        mLocalIOCapabilityBLE = Utils.byteArrayToInt(val);
+                        mLocalIOCapabilityBLE = Utils.byteArrayToInt(packed, off);
                         debugLog("mLocalIOCapabilityBLE set to " + mLocalIOCapabilityBLE);
                         break;
 
@@ -856,23 +863,25 @@ class AdapterProperties {
         }
     }
 
-    private void updateFeatureSupport(byte[] val) {
-        mVersSupported = ((0xFF & ((int) val[1])) << 8) + (0xFF & ((int) val[0]));
-        mNumOfAdvertisementInstancesSupported = (0xFF & ((int) val[3]));
-        mRpaOffloadSupported = ((0xFF & ((int) val[4])) != 0);
-        mNumOfOffloadedIrkSupported = (0xFF & ((int) val[5]));
-        mNumOfOffloadedScanFilterSupported = (0xFF & ((int) val[6]));
-        mIsActivityAndEnergyReporting = ((0xFF & ((int) val[7])) != 0);
-        mOffloadedScanResultStorageBytes = ((0xFF & ((int) val[9])) << 8) + (0xFF & ((int) val[8]));
-        mTotNumOfTrackableAdv = ((0xFF & ((int) val[11])) << 8) + (0xFF & ((int) val[10]));
-        mIsExtendedScanSupported = ((0xFF & ((int) val[12])) != 0);
-        mIsDebugLogSupported = ((0xFF & ((int) val[13])) != 0);
-        mIsLe2MPhySupported = ((0xFF & ((int) val[14])) != 0);
-        mIsLeCodedPhySupported = ((0xFF & ((int) val[15])) != 0);
-        mIsLeExtendedAdvertisingSupported = ((0xFF & ((int) val[16])) != 0);
-        mIsLePeriodicAdvertisingSupported = ((0xFF & ((int) val[17])) != 0);
+    private void updateFeatureSupport(byte[] val, int off) {
+        mVersSupported = ((0xFF & ((int) val[off + 1])) << 8) + (0xFF & ((int) val[off]));
+        mNumOfAdvertisementInstancesSupported = (0xFF & ((int) val[off + 3]));
+        mRpaOffloadSupported = ((0xFF & ((int) val[off + 4])) != 0);
+        mNumOfOffloadedIrkSupported = (0xFF & ((int) val[off + 5]));
+        mNumOfOffloadedScanFilterSupported = (0xFF & ((int) val[off + 6]));
+        mIsActivityAndEnergyReporting = ((0xFF & ((int) val[off + 7])) != 0);
+        mOffloadedScanResultStorageBytes =
+                ((0xFF & ((int) val[off + 9])) << 8) + (0xFF & ((int) val[off + 8]));
+        mTotNumOfTrackableAdv =
+                ((0xFF & ((int) val[off + 11])) << 8) + (0xFF & ((int) val[off + 10]));
+        mIsExtendedScanSupported = ((0xFF & ((int) val[off + 12])) != 0);
+        mIsDebugLogSupported = ((0xFF & ((int) val[off + 13])) != 0);
+        mIsLe2MPhySupported = ((0xFF & ((int) val[off + 14])) != 0);
+        mIsLeCodedPhySupported = ((0xFF & ((int) val[off + 15])) != 0);
+        mIsLeExtendedAdvertisingSupported = ((0xFF & ((int) val[off + 16])) != 0);
+        mIsLePeriodicAdvertisingSupported = ((0xFF & ((int) val[off + 17])) != 0);
         mLeMaximumAdvertisingDataLength =
-                (0xFF & ((int) val[18])) + ((0xFF & ((int) val[19])) << 8);
+                (0xFF & ((int) val[off + 18])) + ((0xFF & ((int) val[off + 19])) << 8);
 
         Log.d(TAG, "BT_PROPERTY_LOCAL_LE_FEATURES: update from BT controller"
                 + " mNumOfAdvertisementInstancesSupported = "
@@ -74,6 +74,7 @@ import android.content.Intent;
 import android.content.IntentFilter;
 import android.content.SharedPreferences;
 import android.content.pm.PackageManager;
+import android.database.ContentObserver;
 import android.os.AsyncTask;
 import android.os.BatteryStats;
 import android.os.Binder;
@@ -114,6 +115,7 @@ import com.android.internal.app.IBatteryStats;
 
 import com.google.protobuf.InvalidProtocolBufferException;
 
+import java.io.ByteArrayOutputStream;
 import java.io.FileDescriptor;
 import java.io.FileOutputStream;
 import java.io.IOException;
@@ -154,6 +156,9 @@ public class AdapterService extends Service {
     static final String BLUETOOTH_BTSNOOP_LOG_MODE_PROPERTY = "persist.bluetooth.btsnooplogmode";
     static final String BLUETOOTH_BTSNOOP_DEFAULT_MODE_PROPERTY =
             "persist.bluetooth.btsnoopdefaultmode";
+    /* Interval of native controller energy sampling while the stack is up; 0 disables it */
+    static final String BLUETOOTH_ENERGY_SAMPLING_PROPERTY =
+            "persist.bluetooth.energy_sampling_ms";
     private String mSnoopLogSettingAtEnable = "empty";
     private String mDefaultSnoopLogSettingAtEnable = "empty";
 
@@ -178,6 +183,17 @@ public class AdapterService extends Service {
         classInitNative();
     }
 
+    /**
+     * Registers the natives of {@code profile}, the first time it is called for that profile.
+     * Classes with profile natives call this from their static initializer, before
+     * classInitNative, so profiles that never start never resolve their JNI methods.
+     */
+    public static void registerProfileNatives(String profile) {
+        if (!registerProfileNativesNative(profile)) {
+            Log.e(TAG, "registerProfileNatives: unable to register " + profile);
+        }
+    }
+
     private static AdapterService sAdapterService;
 
     public static synchronized AdapterService getAdapterService() {
@@ -359,17 +375,77 @@ public class AdapterService extends Service {
 
     private final AdapterServiceHandler mHandler = new AdapterServiceHandler();
 
-    private void updateInteropDatabase() {
-        interopDatabaseClearNative();
+    /* Compiled interop table, loaded ahead of the entries from settings */
+    private static final String INTEROP_DATABASE_FILE =
+            "/data/misc/bluedroid/interop_database.bin";
+
+    // Runs on every change to the Settings list, so edits apply without a restart.
+    private final ContentObserver mInteropObserver = new ContentObserver(mHandler) {
+        @Override
+        public void onChange(boolean selfChange) {
+            updateInteropDatabase(INTEROP_DATABASE_FILE);
+        }
+    };
 
+    /**
+     * Swaps the entries of the table at {@code path}, followed by the entries of the Settings
+     * list, into the native interop database. The new table is built and validated natively
+     * before the database is touched, so on failure the current database is kept. Entries
+     * are only ever added while the stack runs; removed ones apply after a restart.
+     *
+     * @return true if the new table was loaded
+     */
+    @VisibleForTesting
+    boolean updateInteropDatabase(String path) {
         String interopString = Settings.Global.getString(getContentResolver(),
                 Settings.Global.BLUETOOTH_INTEROPERABILITY_LIST);
+        if (interopString != null) {
+            Log.d(TAG, "updateInteropDatabase: [" + interopString + "]");
+        }
+
+        int loaded = interopDatabaseLoadNative(path, packInteropEntries(interopString));
+        if (loaded < 0) {
+            Log.e(TAG, "updateInteropDatabase: unable to load " + path
+                    + ", keeping current database");
+            return false;
+        }
+        Log.d(TAG, "updateInteropDatabase: " + loaded + " entries");
+        return true;
+    }
+
+    /**
+     * Loads the interop database once the native stack is up, and again whenever the Settings
+     * list changes.
+     *
+     * Until now nothing called updateInteropDatabase(), so entries in
+     * {@link Settings.Global#BLUETOOTH_INTEROPERABILITY_LIST} were never applied and the stack
+     * only had its built-in database. Loading here is what applies them, together with the
+     * compiled table. Loads only add entries, so enabling this cannot take a workaround away
+     * from a device that is in use.
+     */
+    private void startInteropDatabase() {
+        updateInteropDatabase(INTEROP_DATABASE_FILE);
+        getContentResolver().registerContentObserver(
+                Settings.Global.getUriFor(Settings.Global.BLUETOOTH_INTEROPERABILITY_LIST),
+                false, mInteropObserver);
+    }
+
+    private void stopInteropDatabase() {
+        getContentResolver().unregisterContentObserver(mInteropObserver);
+    }
+
+    /**
+     * Packs the "address,feature;..." Settings list into native interop entries. Malformed
+     * entries are skipped.
+     */
+    @VisibleForTesting
+    static byte[] packInteropEntries(String interopString) {
         if (interopString == null) {
-            return;
+            return new byte[0];
         }
-        Log.d(TAG, "updateInteropDatabase: [" + interopString + "]");
 
         String[] entries = interopString.split(";");
+        ByteArrayOutputStream packed = new ByteArrayOutputStream();
         for (String entry : entries) {
             String[] tokens = entry.split(",");
             if (tokens.length != 2) {
@@ -400,7 +476,7 @@ public class AdapterService extends Service {
                 } else {
                     try {
                         addr[offset++] = (byte) Integer.parseInt(tokens[0].substring(i, i + 2), 16);
-                    } catch (NumberFormatException e) {
+                    } catch (NumberFormatException | IndexOutOfBoundsException e) {
                         offset = 0;
                         break;
                     }
@@ -413,9 +489,14 @@ public class AdapterService extends Service {
                 continue;
             }
 
-            // Add entry
-            interopDatabaseAddNative(feature, addr, length);
+            // Add entry: feature (LE16), length, reserved, address
+            packed.write(feature & 0xFF);
+            packed.write((feature >> 8) & 0xFF);
+            packed.write(length);
+            packed.write(0);
+            packed.write(addr, 0, addr.length);
         }
+        return packed.toByteArray();
     }
 
     @Override
@@ -432,6 +513,7 @@ public class AdapterService extends Service {
         mJniCallbacks = new JniCallbacks(this, mAdapterProperties);
         initNative(isGuest(), isNiapMode());
         mNativeAvailable = true;
+        startInteropDatabase();
         mCallbacks = new RemoteCallbackList<IBluetoothCallback>();
         mAppOps = getSystemService(AppOpsManager.class);
         //Load the name and address
@@ -693,6 +775,15 @@ public class AdapterService extends Service {
                 mAdapterStateMachine.sendMessage(AdapterState.BLE_TURN_OFF);
             }
         }
+
+        if (newState == BluetoothAdapter.STATE_BLE_ON
+                && prevState == BluetoothAdapter.STATE_BLE_TURNING_ON
+                && mAdapterProperties.isActivityAndEnergyReportingSupported()) {
+            setEnergySamplingInterval(
+                    SystemProperties.getInt(BLUETOOTH_ENERGY_SAMPLING_PROPERTY, 0));
+        } else if (newState == BluetoothAdapter.STATE_BLE_TURNING_OFF) {
+            setEnergySamplingInterval(0);
+        }
     }
 
     void cleanup() {
@@ -707,6 +798,7 @@ public class AdapterService extends Service {
         mCleaningUp = true;
 
         unregisterReceiver(mAlarmBroadcastReceiver);
+        stopInteropDatabase();
 
         if (mPendingAlarm != null) {
             mAlarmManager.cancel(mPendingAlarm);
@@ -2858,6 +2950,14 @@ public class AdapterService extends Service {
         return true;
     }
 
+    /**
+     * Polls controller energy info natively every {@code intervalMillis}; 0 stops polling.
+     * Sampled readings are folded into the totals reported on the next {@link #readEnergyInfo}.
+     */
+    void setEnergySamplingInterval(int intervalMillis) {
+        setEnergySamplingIntervalNative(intervalMillis);
+    }
+
     private void energyInfoCallback(int status, int ctrlState, long txTime, long rxTime,
             long idleTime, long energyUsed, UidTraffic[] data) throws RemoteException {
         if (ctrlState >= BluetoothActivityEnergyInfo.BT_STACK_STATE_INVALID
@@ -3010,6 +3110,17 @@ public class AdapterService extends Service {
             dumpMetrics(fd);
             return;
         }
+        if (args[0].equals("--native-bin")) {
+            int sections = parseNativeDumpSections(args);
+            if (sections < 0) {
+                writer.println("Unknown native dump section, expected any of: "
+                        + TextUtils.join(" ", Arrays.copyOfRange(NATIVE_DUMP_SECTIONS, 1,
+                                NATIVE_DUMP_SECTIONS.length)));
+                return;
+            }
+            dumpBinaryNative(fd, sections);
+            return;
+        }
 
         writer.println();
         mAdapterProperties.dump(fd, writer, args);
@@ -3031,6 +3142,32 @@ public class AdapterService extends Service {
         dumpNative(fd, args);
     }
 
+    /* Section ids of the native binary dump, see BtDumpSection in com_android_bluetooth_dump.h */
+    @VisibleForTesting
+    static final String[] NATIVE_DUMP_SECTIONS = {
+            null, "adv", "wakelock", "energy", "jni", "journal",
+    };
+
+    /**
+     * Turns the section names following --native-bin into the native section mask.
+     * No names selects every section.
+     *
+     * @return the mask, or -1 if any name is not a known section
+     */
+    @VisibleForTesting
+    static int parseNativeDumpSections(String[] args) {
+        int mask = 0;
+        for (int i = 1; i < args.length; i++) {
+            int section = Arrays.asList(NATIVE_DUMP_SECTIONS).indexOf(args[i]);
+            if (section <= 0) {
+                Log.w(TAG, "dump: unknown native section " + args[i]);
+                return -1;
+            }
+            mask |= 1 << section;
+        }
+        return mask;
+    }
+
     private void dumpMetrics(FileDescriptor fd) {
         BluetoothMetricsProto.BluetoothLog.Builder metricsBuilder =
                 BluetoothMetricsProto.BluetoothLog.newBuilder();
@@ -3095,6 +3232,9 @@ public class AdapterService extends Service {
     /**
      *  Obfuscate Bluetooth MAC address into a PII free ID string
      *
+     *  The result is memoized natively and the same array may be returned for the same
+     *  device again, so callers must not modify it.
+     *
      *  @param device Bluetooth device whose MAC address will be obfuscated
      *  @return a byte array that is unique to this MAC address on this device,
      *          or empty byte array when either device is null or obfuscateAddressNative fails
@@ -3108,6 +3248,8 @@ public class AdapterService extends Service {
 
     static native void classInitNative();
 
+    private static native boolean registerProfileNativesNative(String profile);
+
     native boolean initNative(boolean startRestricted, boolean isNiapMode);
 
     native void cleanupNative();
@@ -3165,11 +3307,20 @@ public class AdapterService extends Service {
     /*package*/
     native boolean getRemoteServicesNative(byte[] address);
 
+    /**
+     * Makes the next property update of the device at {@code address}, or of every device if
+     * null, report all of its properties instead of only the changed ones.
+     */
+    /*package*/
+    native void refreshRemoteDevicePropertiesNative(byte[] address);
+
     /*package*/
     native boolean getRemoteMasInstancesNative(byte[] address);
 
     private native int readEnergyInfo();
 
+    private native void setEnergySamplingIntervalNative(int intervalMillis);
+
     private native IBinder getSocketManagerNative();
 
     private native void setSystemUiUidNative(int systemUiUid);
@@ -3183,12 +3334,16 @@ public class AdapterService extends Service {
 
     private native void dumpNative(FileDescriptor fd, String[] arguments);
 
+    private native void dumpBinaryNative(FileDescriptor fd, int sections);
+
     private native byte[] dumpMetricsNative();
 
     private native void interopDatabaseClearNative();
 
     private native void interopDatabaseAddNative(int feature, byte[] address, int length);
 
+    private native int interopDatabaseLoadNative(String path, byte[] extraEntries);
+
     private native byte[] obfuscateAddressNative(byte[] address);
 
     // Returns if this is a mock object. This is currently used in testing so that we may not call
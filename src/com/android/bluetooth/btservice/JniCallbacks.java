@@ -16,7 +16,11 @@
 
 package com.android.bluetooth.btservice;
 
+import java.util.Arrays;
+
 final class JniCallbacks {
+    /* Type and length, both 32-bit little endian, precede each packed property value */
+    private static final int PACKED_PROPERTY_HEADER_LEN = 8;
 
     private RemoteDevices mRemoteDevices;
     private AdapterProperties mAdapterProperties;
@@ -49,14 +53,58 @@ final class JniCallbacks {
         mBondStateMachine.sspRequestCallback(address, name, cod, pairingVariant, passkey);
     }
 
-    void devicePropertyChangedCallback(byte[] address, int[] types, byte[][] val) {
-        mRemoteDevices.devicePropertyChangedCallback(address, types, val);
+    /*
+     * Properties arrive packed by the native layer into one array, with the record of each
+     * property starting at one of the offsets handed along. AdapterProperties and
+     * RemoteDevices read values in place with the helpers below, and copy out only the
+     * values they keep beyond the callback.
+     */
+
+    private static int readLe32(byte[] packed, int pos) {
+        return (packed[pos] & 0xFF) | ((packed[pos + 1] & 0xFF) << 8)
+                | ((packed[pos + 2] & 0xFF) << 16) | ((packed[pos + 3] & 0xFF) << 24);
+    }
+
+    /** Type of the packed property whose record starts at {@code offset} */
+    static int propertyType(byte[] packed, int offset) {
+        return readLe32(packed, offset);
+    }
+
+    /** Where the value of the packed property whose record starts at {@code offset} starts */
+    static int propertyValueOffset(int offset) {
+        return offset + PACKED_PROPERTY_HEADER_LEN;
+    }
+
+    /** Length of the value of the packed property whose record starts at {@code offset} */
+    static int propertyValueLength(byte[] packed, int offset) {
+        return readLe32(packed, offset + 4);
+    }
+
+    /** Copy of the value of the packed property whose record starts at {@code offset} */
+    static byte[] copyPropertyValue(byte[] packed, int offset) {
+        int start = propertyValueOffset(offset);
+        return Arrays.copyOfRange(packed, start, start + propertyValueLength(packed, offset));
+    }
+
+    void devicePropertyChangedCallback(byte[] address, byte[] packed, int[] offsets) {
+        mRemoteDevices.devicePropertyChangedCallback(address, packed, offsets);
     }
 
     void deviceFoundCallback(byte[] address) {
         mRemoteDevices.deviceFoundCallback(address);
     }
 
+    /**
+     * Inquiry result with the properties that changed since the last result for the same
+     * device in this discovery session. {@code offsets} is empty when nothing changed.
+     */
+    void deviceFoundWithPropertiesCallback(byte[] address, byte[] packed, int[] offsets) {
+        if (offsets.length > 0) {
+            devicePropertyChangedCallback(address, packed, offsets);
+        }
+        mRemoteDevices.deviceFoundCallback(address);
+    }
+
     void pinRequestCallback(byte[] address, byte[] name, int cod, boolean min16Digits) {
         mBondStateMachine.pinRequestCallback(address, name, cod, min16Digits);
     }
@@ -77,8 +125,8 @@ final class JniCallbacks {
         mAdapterProperties.discoveryStateChangeCallback(state);
     }
 
-    void adapterPropertyChangedCallback(int[] types, byte[][] val) {
-        mAdapterProperties.adapterPropertyChangedCallback(types, val);
+    void adapterPropertyChangedCallback(byte[] packed, int[] offsets) {
+        mAdapterProperties.adapterPropertyChangedCallback(packed, offsets);
     }
 
 }
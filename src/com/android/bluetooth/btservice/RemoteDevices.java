@@ -194,6 +194,7 @@ final class RemoteDevices {
 
         if (mDevices != null) {
             mDevices.clear();
+            sAdapterService.refreshRemoteDevicePropertiesNative(null);
         }
 
         if (mDeviceQueue != null) {
@@ -240,6 +241,9 @@ final class RemoteDevices {
                     }
                     debugLog("Removing device " + deleteKey + " from property map");
                     mDevices.remove(deleteKey);
+                    // Properties of the device must be reported in full if it shows up again
+                    sAdapterService.refreshRemoteDevicePropertiesNative(
+                            Utils.getBytesFromAddress(deleteKey));
                 }
             }
             return prop;
@@ -589,10 +593,15 @@ final class RemoteDevices {
         return set.isEmpty();
     }
 
-    void devicePropertyChangedCallback(byte[] address, int[] types, byte[][] values) {
+    /**
+     * Applies remote device properties packed by the native layer; see {@link JniCallbacks}.
+     * Values are read in place, and only the ones kept are copied out of {@code packed}.
+     */
+    void devicePropertyChangedCallback(byte[] address, byte[] packed, int[] offsets) {
         Intent intent;
-        byte[] val;
         int type;
+        int off;
+        int len;
         BluetoothDevice bdDevice = getDevice(address);
         DeviceProperties device;
         if (bdDevice == null) {
@@ -603,20 +612,21 @@ final class RemoteDevices {
             device = getDeviceProperties(bdDevice);
         }
 
-        if (types.length <= 0) {
+        if (offsets.length <= 0) {
             errorLog("No properties to update");
             return;
         }
 
-        for (int j = 0; j < types.length; j++) {
-            type = types[j];
-            val = values[j];
-            if (val.length > 0) {
+        for (int j = 0; j < offsets.length; j++) {
+            type = JniCallbacks.propertyType(packed, offsets[j]);
+            off = JniCallbacks.propertyValueOffset(offsets[j]);
+            len = JniCallbacks.propertyValueLength(packed, offsets[j]);
+            if (len > 0) {
                 synchronized (mObject) {
                     debugLog("Property type: " + type);
                     switch (type) {
                         case AbstractionLayer.BT_PROPERTY_BDNAME:
-                            final String newName = new String(val);
+                            final String newName = new String(packed, off, len);
                             if (newName.equals(device.mName)) {
                                 debugLog("Skip name update for " + bdDevice);
                                 break;
@@ -630,20 +640,21 @@ final class RemoteDevices {
                             debugLog("Remote Device name is: " + device.mName);
                             break;
                         case AbstractionLayer.BT_PROPERTY_REMOTE_FRIENDLY_NAME:
-                            device.mAlias = new String(val);
+                            device.mAlias = new String(packed, off, len);
                             debugLog("Remote device alias is: " + device.mAlias);
                             break;
                         case AbstractionLayer.BT_PROPERTY_BDADDR:
-                            device.mAddress = val;
-                            debugLog("Remote Address is:" + Utils.getAddressStringFromByte(val));
+                            device.mAddress = JniCallbacks.copyPropertyValue(packed, offsets[j]);
+                            debugLog("Remote Address is:"
+                                    + Utils.getAddressStringFromByte(device.mAddress));
                             break;
                         case AbstractionLayer.BT_PROPERTY_CLASS_OF_DEVICE:
-                            final int newClass = Utils.byteArrayToInt(val);
+                            final int newClass = Utils.byteArrayToInt(packed, off);
                             if (newClass == device.mBluetoothClass) {
                                 debugLog("Skip class update for " + bdDevice);
                                 break;
                             }
-                            device.mBluetoothClass = Utils.byteArrayToInt(val);
+                            device.mBluetoothClass = newClass;
                             intent = new Intent(BluetoothDevice.ACTION_CLASS_CHANGED);
                             intent.putExtra(BluetoothDevice.EXTRA_DEVICE, bdDevice);
                             intent.putExtra(BluetoothDevice.EXTRA_CLASS,
@@ -653,8 +664,8 @@ final class RemoteDevices {
                             debugLog("Remote class is:" + device.mBluetoothClass);
                             break;
                         case AbstractionLayer.BT_PROPERTY_UUIDS:
-                            int numUuids = val.length / AbstractionLayer.BT_UUID_SIZE;
-                            final ParcelUuid[] newUuids = Utils.byteArrayToUuid(val);
+                            int numUuids = len / AbstractionLayer.BT_UUID_SIZE;
+                            final ParcelUuid[] newUuids = Utils.byteArrayToUuid(packed, off, len);
                             if (areUuidsEqual(newUuids, device.mUuids)) {
                                 debugLog( "Skip uuids update for " + bdDevice.getAddress());
                                 break;
@@ -670,11 +681,11 @@ final class RemoteDevices {
                         case AbstractionLayer.BT_PROPERTY_TYPE_OF_DEVICE:
                             // The device type from hal layer, defined in bluetooth.h,
                             // matches the type defined in BluetoothDevice.java
-                            device.mDeviceType = Utils.byteArrayToInt(val);
+                            device.mDeviceType = Utils.byteArrayToInt(packed, off);
                             break;
                         case AbstractionLayer.BT_PROPERTY_REMOTE_RSSI:
                             // RSSI from hal is in one byte
-                            device.mRssi = val[0];
+                            device.mRssi = packed[off];
                             break;
                     }
                 }
@@ -40,6 +40,7 @@ final class VendorSocket {
     private AdapterService mService;
 
     static {
+        AdapterService.registerProfileNatives("vendor_socket");
         classInitNative();
     }
 
@@ -26,9 +26,11 @@ import android.os.IBinder;
 import android.os.IInterface;
 import android.os.Looper;
 import android.os.RemoteException;
+import android.os.SystemProperties;
 import android.util.Log;
 
 import com.android.bluetooth.btservice.AdapterService;
+import com.android.internal.annotations.VisibleForTesting;
 
 import java.util.Collections;
 import java.util.HashMap;
@@ -47,7 +49,31 @@ class AdvertiseManager {
     private final AdapterService mAdapterService;
     private Handler mHandler;
     Map<IBinder, AdvertiserInfo> mAdvertisers = Collections.synchronizedMap(new HashMap<>());
+    Map<Integer, PendingStart> mPendingStarts = Collections.synchronizedMap(new HashMap<>());
     static int sTempRegistrationId = -1;
+    /* Whether a controller set is reserved for virtual sets, see updateVirtualSetReservation() */
+    private boolean mVirtualSetsReserved;
+
+    /* Status reported by the stack when the controller has no free advertising sets */
+    private static final int ADVERTISE_FAILED_TOO_MANY_ADVERTISERS = 2;
+    /* Air time per turn of a virtual set with weight 1, in milliseconds */
+    private static final String ADV_MUX_SLICE_PROPERTY = "persist.bluetooth.adv_mux_slice_ms";
+    private static final int DEFAULT_ADV_MUX_SLICE_MS = 1000;
+    /* Advertiser ids the native multiplexer hands out to virtual sets */
+    private static final int FIRST_VIRTUAL_ADVERTISER_ID = 0x80;
+    private static final int LAST_VIRTUAL_ADVERTISER_ID = 0xEF;
+
+    /* Layout of the packed int[] form of AdvertisingSetParameters, see packParameters() */
+    static final int PACKED_PARAM_CONNECTABLE = 0;
+    static final int PACKED_PARAM_SCANNABLE = 1;
+    static final int PACKED_PARAM_LEGACY = 2;
+    static final int PACKED_PARAM_ANONYMOUS = 3;
+    static final int PACKED_PARAM_INCLUDE_TX_POWER = 4;
+    static final int PACKED_PARAM_PRIMARY_PHY = 5;
+    static final int PACKED_PARAM_SECONDARY_PHY = 6;
+    static final int PACKED_PARAM_INTERVAL = 7;
+    static final int PACKED_PARAM_TX_POWER_LEVEL = 8;
+    static final int PACKED_PARAM_COUNT = 9;
 
     /**
      * Constructor of {@link AdvertiseManager}.
@@ -65,6 +91,8 @@ class AdvertiseManager {
      */
     void start() {
         initializeNative();
+        setAdvertisingMuxSliceNative(
+                SystemProperties.getInt(ADV_MUX_SLICE_PROPERTY, DEFAULT_ADV_MUX_SLICE_MS));
         HandlerThread thread = new HandlerThread("BluetoothAdvertiseManager");
         thread.start();
         mHandler = new Handler(thread.getLooper());
@@ -76,7 +104,9 @@ class AdvertiseManager {
         }
         cleanupNative();
         mAdvertisers.clear();
+        mPendingStarts.clear();
         sTempRegistrationId = -1;
+        mVirtualSetsReserved = false;
 
         if (mHandler != null) {
             // Shut down the thread
@@ -104,6 +134,25 @@ class AdvertiseManager {
         }
     }
 
+    /**
+     * Arguments of a start request kept until the stack answers, so that the set can be
+     * re-registered as a virtual set if the controller is out of advertising sets.
+     */
+    static class PendingStart {
+        public final int[] parameters;
+        public final byte[] advertiseData;
+        public final byte[] scanResponse;
+        public final boolean periodic;
+
+        PendingStart(int[] parameters, byte[] advertiseData, byte[] scanResponse,
+                boolean periodic) {
+            this.parameters = parameters;
+            this.advertiseData = advertiseData;
+            this.scanResponse = scanResponse;
+            this.periodic = periodic;
+        }
+    }
+
     IBinder toBinder(IAdvertisingSetCallback e) {
         return ((IInterface) e).asBinder();
     }
@@ -143,8 +192,21 @@ class AdvertiseManager {
                             + ", status=" + status);
         }
 
+        PendingStart pending = mPendingStarts.remove(regId);
         Map.Entry<IBinder, AdvertiserInfo> entry = findAdvertiser(regId);
 
+        if (entry != null && pending != null && !pending.periodic
+                && status == ADVERTISE_FAILED_TOO_MANY_ADVERTISERS) {
+            int virtualId = startVirtualAdvertisingSet(pending);
+            if (virtualId >= 0) {
+                Log.i(TAG, "onAdvertisingSetStarted() - controller out of sets, regId " + regId
+                        + " multiplexed as advertiserId " + virtualId);
+                advertiserId = virtualId;
+                txPower = pending.parameters[PACKED_PARAM_TX_POWER_LEVEL];
+                status = 0;
+            }
+        }
+
         if (entry == null) {
             Log.i(TAG, "onAdvertisingSetStarted() - no callback found for regId " + regId);
             // Advertising set was stopped before it was properly registered.
@@ -161,10 +223,67 @@ class AdvertiseManager {
             binder.unlinkToDeath(entry.getValue().deathRecipient, 0);
             mAdvertisers.remove(binder);
         }
+        updateVirtualSetReservation();
 
         callback.onAdvertisingSetStarted(advertiserId, txPower, status);
     }
 
+    static boolean isVirtualAdvertiserId(int advertiserId) {
+        return advertiserId >= FIRST_VIRTUAL_ADVERTISER_ID
+                && advertiserId <= LAST_VIRTUAL_ADVERTISER_ID;
+    }
+
+    /**
+     * Reserves a controller set for virtual sets once the running sets leave only one free, as
+     * no set can be started for them after the controller has run out. The reservation is
+     * released when sets are free again and no virtual set is running.
+     */
+    @VisibleForTesting
+    synchronized void updateVirtualSetReservation() {
+        int maxSets = mAdapterService.getNumOfAdvertisementInstancesSupported();
+        if (maxSets < 2) {
+            // Reserving the only set would leave none for apps.
+            return;
+        }
+
+        int physicalSets = 0;
+        boolean virtualSets = false;
+        synchronized (mAdvertisers) {
+            for (AdvertiserInfo info : mAdvertisers.values()) {
+                if (info.id < 0) {
+                    continue;
+                }
+                if (isVirtualAdvertiserId(info.id)) {
+                    virtualSets = true;
+                } else {
+                    physicalSets++;
+                }
+            }
+        }
+
+        boolean reserve = virtualSets || physicalSets >= maxSets - 1;
+        if (reserve != mVirtualSetsReserved) {
+            mVirtualSetsReserved = reserve;
+            reserveVirtualAdvertisingSet(reserve);
+        }
+    }
+
+    @VisibleForTesting
+    public void reserveVirtualAdvertisingSet(boolean reserve) {
+        setAdvertisingMuxReservedNative(reserve);
+    }
+
+    /**
+     * Registers the set of {@code pending} as a virtual set sharing a controller set.
+     *
+     * @return the advertiser id of the virtual set, or a negative value on failure
+     */
+    @VisibleForTesting
+    public int startVirtualAdvertisingSet(PendingStart pending) {
+        return startVirtualAdvertisingSetNative(pending.parameters, pending.advertiseData,
+                pending.scanResponse, virtualSetWeight(pending.parameters[PACKED_PARAM_INTERVAL]));
+    }
+
     void onAdvertisingEnabled(int advertiserId, boolean enable, int status) throws Exception {
         if (DBG) {
             Log.d(TAG, "onAdvertisingSetEnabled() - advertiserId=" + advertiserId + ", enable="
@@ -202,11 +321,16 @@ class AdvertiseManager {
         int cbId = --sTempRegistrationId;
         mAdvertisers.put(binder, new AdvertiserInfo(cbId, deathRecipient, callback));
 
+        int[] packedParameters = packParameters(parameters);
+        mPendingStarts.put(cbId, new PendingStart(packedParameters, advDataBytes,
+                scanResponseBytes, periodicParameters != null));
+
         if (DBG) {
             Log.d(TAG, "startAdvertisingSet() - reg_id=" + cbId + ", callback: " + binder);
         }
-        startAdvertisingSetNative(parameters, advDataBytes, scanResponseBytes, periodicParameters,
-                periodicDataBytes, duration, maxExtAdvEvents, cbId);
+        startAdvertisingSetPackedNative(packedParameters, advDataBytes, scanResponseBytes,
+                packPeriodicParameters(periodicParameters), periodicDataBytes, duration,
+                maxExtAdvEvents, cbId);
     }
 
     void onOwnAddressRead(int advertiserId, int addressType, String address)
@@ -251,6 +375,7 @@ class AdvertiseManager {
         }
 
         stopAdvertisingSetNative(advertiserId);
+        updateVirtualSetReservation();
 
         try {
             callback.onAdvertisingSetStopped(advertiserId);
@@ -276,7 +401,7 @@ class AdvertiseManager {
     }
 
     void setAdvertisingParameters(int advertiserId, AdvertisingSetParameters parameters) {
-        setAdvertisingParametersNative(advertiserId, parameters);
+        setAdvertisingParametersPackedNative(advertiserId, packParameters(parameters));
     }
 
     void setPeriodicAdvertisingParameters(int advertiserId,
@@ -394,7 +519,53 @@ class AdvertiseManager {
         callback.onPeriodicAdvertisingEnabled(advertiserId, enable, status);
     }
 
+    /**
+     * Flattens {@link AdvertisingSetParameters} into the int[] layout expected by the packed
+     * native calls, so that native code does not call back into Java for each getter.
+     */
+    static int[] packParameters(AdvertisingSetParameters parameters) {
+        int[] packed = new int[PACKED_PARAM_COUNT];
+        packed[PACKED_PARAM_CONNECTABLE] = parameters.isConnectable() ? 1 : 0;
+        packed[PACKED_PARAM_SCANNABLE] = parameters.isScannable() ? 1 : 0;
+        packed[PACKED_PARAM_LEGACY] = parameters.isLegacy() ? 1 : 0;
+        packed[PACKED_PARAM_ANONYMOUS] = parameters.isAnonymous() ? 1 : 0;
+        packed[PACKED_PARAM_INCLUDE_TX_POWER] = parameters.includeTxPower() ? 1 : 0;
+        packed[PACKED_PARAM_PRIMARY_PHY] = parameters.getPrimaryPhy();
+        packed[PACKED_PARAM_SECONDARY_PHY] = parameters.getSecondaryPhy();
+        packed[PACKED_PARAM_INTERVAL] = parameters.getInterval();
+        packed[PACKED_PARAM_TX_POWER_LEVEL] = parameters.getTxPowerLevel();
+        return packed;
+    }
+
+    /**
+     * Relative air time of a virtual set. A set asking for a shorter advertising interval gets
+     * proportionally longer turns, from 1 at {@link AdvertisingSetParameters#INTERVAL_HIGH} up to
+     * 10 at {@link AdvertisingSetParameters#INTERVAL_LOW}.
+     */
+    static int virtualSetWeight(int interval) {
+        if (interval <= 0) {
+            return 1;
+        }
+        return Math.max(1, AdvertisingSetParameters.INTERVAL_HIGH / interval);
+    }
+
+    /**
+     * Flattens {@link PeriodicAdvertisingParameters} for the packed native calls. A null value
+     * packs as disabled periodic advertising.
+     */
+    static int[] packPeriodicParameters(PeriodicAdvertisingParameters parameters) {
+        if (parameters == null) {
+            return new int[] {0, 0, 0};
+        }
+        return new int[] {
+                1,
+                parameters.getIncludeTxPower() ? 1 : 0,
+                parameters.getInterval(),
+        };
+    }
+
     static {
+        AdapterService.registerProfileNatives("gatt");
         classInitNative();
     }
 
@@ -404,9 +575,8 @@ class AdvertiseManager {
 
     private native void cleanupNative();
 
-    private native void startAdvertisingSetNative(AdvertisingSetParameters parameters,
-            byte[] advertiseData, byte[] scanResponse,
-            PeriodicAdvertisingParameters periodicParameters, byte[] periodicData, int duration,
+    private native void startAdvertisingSetPackedNative(int[] parameters, byte[] advertiseData,
+            byte[] scanResponse, int[] periodicParameters, byte[] periodicData, int duration,
             int maxExtAdvEvents, int regId);
 
     private native void getOwnAddressNative(int advertiserId);
@@ -420,8 +590,14 @@ class AdvertiseManager {
 
     private native void setScanResponseDataNative(int advertiserId, byte[] data);
 
-    private native void setAdvertisingParametersNative(int advertiserId,
-            AdvertisingSetParameters parameters);
+    private native int startVirtualAdvertisingSetNative(int[] parameters, byte[] advertiseData,
+            byte[] scanResponse, int weight);
+
+    private native void setAdvertisingMuxSliceNative(int sliceMillis);
+
+    private native void setAdvertisingMuxReservedNative(boolean reserved);
+
+    private native void setAdvertisingParametersPackedNative(int advertiserId, int[] parameters);
 
     private native void setPeriodicAdvertisingParametersNative(int advertiserId,
             PeriodicAdvertisingParameters parameters);
@@ -429,4 +605,5 @@ class AdvertiseManager {
     private native void setPeriodicAdvertisingDataNative(int advertiserId, byte[] data);
 
     private native void setPeriodicAdvertisingEnableNative(int advertiserId, boolean enable);
+
 }
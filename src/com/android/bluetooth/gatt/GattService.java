@@ -46,10 +46,13 @@ import android.bluetooth.le.ScanResult;
 import android.bluetooth.le.ScanSettings;
 import android.content.Intent;
 import android.os.Binder;
+import android.os.Handler;
 import android.os.IBinder;
+import android.os.Looper;
 import android.os.ParcelUuid;
 import android.os.RemoteException;
 import android.os.SystemClock;
+import android.os.SystemProperties;
 import android.os.UserHandle;
 import android.os.WorkSource;
 import android.util.Log;
@@ -115,6 +118,22 @@ public class GattService extends ProfileService {
     private static final UUID FIDO_SERVICE_UUID =
             UUID.fromString("0000FFFD-0000-1000-8000-00805F9B34FB"); // U2F
 
+    /**
+     * Comma separated characteristic UUIDs whose notifications only need their latest value
+     * delivered: a notification still queued for the same handle is replaced by a newer one.
+     */
+    private static final String LATEST_ONLY_UUIDS_PROPERTY =
+            "persist.bluetooth.gatt_latest_only_uuids";
+
+    /**
+     * Comma separated characteristic UUIDs whose values are split natively to fit the connection
+     * MTU, each fragment carrying a frame sequence number and a fragment index.
+     */
+    private static final String FRAMED_UUIDS_PROPERTY = "persist.bluetooth.gatt_framed_uuids";
+
+    // Returned by gattServerQueueNotificationNative when a latest-only value replaced a queued one.
+    private static final int NOTIFICATION_REPLACED = -1;
+
     /**
      * Keep the arguments passed in for the PendingIntent.
      */
@@ -180,6 +199,9 @@ public class GattService extends ProfileService {
     private PeriodicScanManager mPeriodicScanManager;
     private ScanManager mScanManager;
     private AppOpsManager mAppOps;
+    private Handler mHandler;
+    private Set<UUID> mLatestOnlyUuids = Collections.emptySet();
+    private Set<UUID> mFramedUuids = Collections.emptySet();
 
     private static GattService sGattService;
 
@@ -189,6 +211,7 @@ public class GattService extends ProfileService {
     private Set<String> mReliableQueue = new HashSet<String>();
 
     static {
+        AdapterService.registerProfileNatives("gatt");
         classInitNative();
     }
 
@@ -205,6 +228,9 @@ public class GattService extends ProfileService {
         initializeNative();
         mAdapter = BluetoothAdapter.getDefaultAdapter();
         mAppOps = getSystemService(AppOpsManager.class);
+        mHandler = new Handler(Looper.getMainLooper());
+        mLatestOnlyUuids = parseUuidList(SystemProperties.get(LATEST_ONLY_UUIDS_PROPERTY, ""));
+        mFramedUuids = parseUuidList(SystemProperties.get(FRAMED_UUIDS_PROPERTY, ""));
         mAdvertiseManager = new AdvertiseManager(this, AdapterService.getAdapterService());
         mAdvertiseManager.start();
 
@@ -224,6 +250,9 @@ public class GattService extends ProfileService {
             Log.d(TAG, "stop()");
         }
         setGattService(null);
+        if (mHandler != null) {
+            mHandler.removeCallbacksAndMessages(null);
+        }
         mScannerMap.clear();
         mClientMap.clear();
         mServerMap.clear();
@@ -2654,6 +2683,13 @@ public class GattService extends ProfileService {
                             + connected);
         }
 
+        if (connected) {
+            // A bonded peer keeps the CCCD values it wrote on earlier connections.
+            BluetoothDevice device = mAdapter.getRemoteDevice(address);
+            gattServerRestoreSubscriptionsNative(connId,
+                    device.getBondState() == BluetoothDevice.BOND_BONDED);
+        }
+
         ServerMap.App app = mServerMap.getById(serverIf);
         if (app == null) {
             return;
@@ -3019,13 +3055,50 @@ public class GattService extends ProfileService {
             return;
         }
 
-        if (confirm) {
-            gattServerSendIndicationNative(serverIf, handle, connId, value);
-        } else {
-            gattServerSendNotificationNative(serverIf, handle, connId, value);
+        boolean latestOnly = false;
+        boolean framed = false;
+        if (!mLatestOnlyUuids.isEmpty() || !mFramedUuids.isEmpty()) {
+            HandleMap.Entry entry = mHandleMap.getByHandle(handle);
+            if (entry != null) {
+                latestOnly = !confirm && mLatestOnlyUuids.contains(entry.uuid);
+                framed = mFramedUuids.contains(entry.uuid);
+            }
+        }
+
+        int status = gattServerQueueNotificationNative(serverIf, handle, connId, confirm,
+                latestOnly, framed, value);
+        if (status == BluetoothGatt.GATT_SUCCESS) {
+            return;
         }
+
+        // Replaced and refused values never reach the stack, so no completion follows for them.
+        // Report them like one, after this call has returned.
+        final int sentStatus =
+                status == NOTIFICATION_REPLACED ? BluetoothGatt.GATT_SUCCESS : status;
+        mHandler.post(() -> {
+            try {
+                onNotificationSent(connId, sentStatus);
+            } catch (RemoteException e) {
+                Log.e(TAG, "Exception: " + e);
+            }
+        });
     }
 
+    @VisibleForTesting
+    static Set<UUID> parseUuidList(String list) {
+        Set<UUID> uuids = new HashSet<>();
+        for (String uuid : list.split(",")) {
+            if (uuid.trim().isEmpty()) {
+                continue;
+            }
+            try {
+                uuids.add(UUID.fromString(uuid.trim()));
+            } catch (IllegalArgumentException e) {
+                Log.w(TAG, "parseUuidList() - ignoring invalid UUID " + uuid);
+            }
+        }
+        return uuids;
+    }
 
     /**************************************************************************
      * Private functions
@@ -3215,6 +3288,13 @@ public class GattService extends ProfileService {
 
         sb.append("GATT Handle Map\n");
         mHandleMap.dump(sb);
+
+        sb.append("GATT Server Subscriptions\n");
+        int[] subscriptions = gattServerGetSubscriptionsNative();
+        for (int i = 0; subscriptions != null && i + 2 < subscriptions.length; i += 3) {
+            sb.append("  connId: " + subscriptions[i] + ", handle: " + subscriptions[i + 1]
+                    + ", cccd: " + subscriptions[i + 2] + "\n");
+        }
     }
 
     void addScanEvent(BluetoothMetricsProto.ScanEvent event) {
@@ -3335,11 +3415,12 @@ public class GattService extends ProfileService {
 
     private native void gattServerDeleteServiceNative(int serverIf, int svcHandle);
 
-    private native void gattServerSendIndicationNative(int serverIf, int attrHandle, int connId,
-            byte[] val);
+    private native int gattServerQueueNotificationNative(int serverIf, int attrHandle,
+            int connId, boolean confirm, boolean latestOnly, boolean framed, byte[] val);
+
+    private native void gattServerRestoreSubscriptionsNative(int connId, boolean bonded);
 
-    private native void gattServerSendNotificationNative(int serverIf, int attrHandle, int connId,
-            byte[] val);
+    private native int[] gattServerGetSubscriptionsNative();
 
     private native void gattServerSendResponseNative(int serverIf, int connId, int transId,
             int status, int handle, int offset, byte[] val, int authReq);
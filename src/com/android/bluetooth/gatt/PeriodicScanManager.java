@@ -224,6 +224,7 @@ class PeriodicScanManager {
     }
 
     static {
+        AdapterService.registerProfileNatives("gatt");
         classInitNative();
     }
 
@@ -21,6 +21,7 @@ import android.bluetooth.BluetoothDevice;
 import android.util.Log;
 
 import com.android.bluetooth.Utils;
+import com.android.bluetooth.btservice.AdapterService;
 import com.android.internal.annotations.VisibleForTesting;
 
 /**
@@ -34,6 +35,7 @@ public class HeadsetNativeInterface {
     private final BluetoothAdapter mAdapter = BluetoothAdapter.getDefaultAdapter();
 
     static {
+        AdapterService.registerProfileNatives("hfp");
         classInitNative();
     }
 
@@ -24,11 +24,14 @@ import android.bluetooth.BluetoothAdapter;
 import android.bluetooth.BluetoothDevice;
 import android.util.Log;
 
+import com.android.bluetooth.btservice.AdapterService;
+
 class NativeInterface {
     private static final String TAG = "NativeInterface";
     private static final boolean DBG = false;
 
     static {
+        AdapterService.registerProfileNatives("hfpclient");
         classInitNative();
     }
 
@@ -27,6 +27,7 @@ import android.bluetooth.BluetoothDevice;
 import android.util.Log;
 
 import com.android.bluetooth.Utils;
+import com.android.bluetooth.btservice.AdapterService;
 import com.android.internal.annotations.GuardedBy;
 import com.android.internal.annotations.VisibleForTesting;
 
@@ -42,6 +43,7 @@ public class HidDeviceNativeInterface {
     private static final Object INSTANCE_LOCK = new Object();
 
     static {
+        AdapterService.registerProfileNatives("hid_device");
         classInitNative();
     }
 
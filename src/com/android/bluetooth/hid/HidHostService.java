@@ -73,6 +73,7 @@ public class HidHostService extends ProfileService {
     private static final int MESSAGE_SET_IDLE_TIME = 16;
 
     static {
+        AdapterService.registerProfileNatives("hid_host");
         classInitNative();
     }
 
@@ -76,6 +76,7 @@ public class PanService extends ProfileService {
 
 
     static {
+        AdapterService.registerProfileNatives("pan");
         classInitNative();
     }
 
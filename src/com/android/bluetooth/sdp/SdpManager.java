@@ -68,6 +68,7 @@ public class SdpManager {
     private static SdpManager sSdpManager = null;
 
     static {
+        AdapterService.registerProfileNatives("sdp");
         classInitNative();
     }
 
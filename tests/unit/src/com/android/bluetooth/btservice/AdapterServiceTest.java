@@ -56,6 +56,9 @@ import org.junit.runner.RunWith;
 import org.mockito.Mock;
 import org.mockito.MockitoAnnotations;
 
+import java.io.File;
+import java.io.FileOutputStream;
+import java.io.IOException;
 import java.security.InvalidKeyException;
 import java.security.NoSuchAlgorithmException;
 import java.util.Arrays;
@@ -674,6 +677,58 @@ public class AdapterServiceTest {
                 obfuscatedAddress1));
     }
 
+    /**
+     * Test: Verify that native dump section names map to section bits, and that unknown names
+     *       are rejected instead of selecting every section
+     */
+    @Test
+    public void testParseNativeDumpSections() {
+        Assert.assertEquals(0,
+                AdapterService.parseNativeDumpSections(new String[] {"--native-bin"}));
+        Assert.assertEquals((1 << 1) | (1 << 4), AdapterService.parseNativeDumpSections(
+                new String[] {"--native-bin", "adv", "jni"}));
+        Assert.assertEquals(-1, AdapterService.parseNativeDumpSections(
+                new String[] {"--native-bin", "adv", "bogus"}));
+        Assert.assertEquals(-1, AdapterService.parseNativeDumpSections(
+                new String[] {"--native-bin", "null"}));
+    }
+
+    /**
+     * Test: Verify that the Settings interop list is packed into native entries and that
+     *       malformed entries are skipped
+     */
+    @Test
+    public void testPackInteropEntries() {
+        Assert.assertEquals(0, AdapterService.packInteropEntries(null).length);
+        byte[] packed = AdapterService.packInteropEntries(
+                "00:11:22,258;zz:11,1;00:11;ab:cd:ef:01,bad;a,2;12:34:56:78:9a:bc,3");
+        Assert.assertArrayEquals(new byte[] {
+                2, 1, 3, 0, 0x00, 0x11, 0x22, 0, 0, 0,
+                3, 0, 6, 0, 0x12, 0x34, 0x56, 0x78, (byte) 0x9a, (byte) 0xbc,
+        }, packed);
+    }
+
+    /**
+     * Test: Verify that a missing interop table loads as an empty table, and that a malformed
+     *       one is reported without replacing the database
+     */
+    @Test
+    public void testUpdateInteropDatabase() throws IOException {
+        File table = new File(InstrumentationRegistry.getTargetContext().getCacheDir(),
+                "interop_database_test.bin");
+        table.delete();
+        Assert.assertTrue(mAdapterService.updateInteropDatabase(table.getPath()));
+
+        try (FileOutputStream out = new FileOutputStream(table)) {
+            out.write(new byte[] {1, 2, 3, 4, 5});
+        }
+        try {
+            Assert.assertFalse(mAdapterService.updateInteropDatabase(table.getPath()));
+        } finally {
+            table.delete();
+        }
+    }
+
     private static byte[] getMetricsSalt(HashMap<String, HashMap<String, String>> adapterConfig) {
         HashMap<String, String> metricsSection = adapterConfig.get("Metrics");
         if (metricsSection == null) {
@@ -0,0 +1,81 @@
+package com.android.bluetooth.btservice;
+
+import androidx.test.filters.SmallTest;
+import androidx.test.runner.AndroidJUnit4;
+
+import org.junit.Assert;
+import org.junit.Test;
+import org.junit.runner.RunWith;
+
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+import java.util.Arrays;
+
+/**
+ * Test cases for {@link JniCallbacks}.
+ */
+@SmallTest
+@RunWith(AndroidJUnit4.class)
+public class JniCallbacksTest {
+
+    private static void putProperty(ByteBuffer buf, int type, byte[] value) {
+        buf.putInt(type);
+        buf.putInt(value.length);
+        buf.put(value);
+    }
+
+    @Test
+    public void testPackedProperties() {
+        byte[] name = {'p', 'h', 'o', 'n', 'e'};
+        byte[] cod = {0x0c, 0x02, 0x5a, 0x00};
+        ByteBuffer buf = ByteBuffer.allocate(8 + name.length + 8 + 8 + cod.length)
+                .order(ByteOrder.LITTLE_ENDIAN);
+        int[] offsets = new int[3];
+        offsets[0] = buf.position();
+        putProperty(buf, AbstractionLayer.BT_PROPERTY_BDNAME, name);
+        offsets[1] = buf.position();
+        putProperty(buf, AbstractionLayer.BT_PROPERTY_UUIDS, new byte[0]);
+        offsets[2] = buf.position();
+        putProperty(buf, AbstractionLayer.BT_PROPERTY_CLASS_OF_DEVICE, cod);
+        byte[] packed = buf.array();
+
+        Assert.assertEquals(AbstractionLayer.BT_PROPERTY_BDNAME,
+                JniCallbacks.propertyType(packed, offsets[0]));
+        Assert.assertEquals(8, JniCallbacks.propertyValueOffset(offsets[0]));
+        Assert.assertEquals(name.length, JniCallbacks.propertyValueLength(packed, offsets[0]));
+
+        Assert.assertEquals(AbstractionLayer.BT_PROPERTY_UUIDS,
+                JniCallbacks.propertyType(packed, offsets[1]));
+        Assert.assertEquals(0, JniCallbacks.propertyValueLength(packed, offsets[1]));
+
+        Assert.assertEquals(AbstractionLayer.BT_PROPERTY_CLASS_OF_DEVICE,
+                JniCallbacks.propertyType(packed, offsets[2]));
+        int codOffset = JniCallbacks.propertyValueOffset(offsets[2]);
+        Assert.assertEquals(offsets[2] + 8, codOffset);
+        Assert.assertEquals(cod.length, JniCallbacks.propertyValueLength(packed, offsets[2]));
+        Assert.assertArrayEquals(cod,
+                Arrays.copyOfRange(packed, codOffset, codOffset + cod.length));
+    }
+
+    @Test
+    public void testCopyPropertyValue_doesNotAliasPackedBuffer() {
+        byte[] address = {0x00, 0x11, 0x22, 0x33, 0x44, 0x55};
+        ByteBuffer buf = ByteBuffer.allocate(8 + address.length).order(ByteOrder.LITTLE_ENDIAN);
+        putProperty(buf, AbstractionLayer.BT_PROPERTY_BDADDR, address);
+        byte[] packed = buf.array();
+
+        byte[] copy = JniCallbacks.copyPropertyValue(packed, 0);
+        packed[8] = 0x7f;
+
+        Assert.assertArrayEquals(address, copy);
+    }
+
+    @Test
+    public void testPropertyLength_largeValue() {
+        byte[] uuids = new byte[16 * 300];
+        ByteBuffer buf = ByteBuffer.allocate(8 + uuids.length).order(ByteOrder.LITTLE_ENDIAN);
+        putProperty(buf, AbstractionLayer.BT_PROPERTY_UUIDS, uuids);
+
+        Assert.assertEquals(uuids.length, JniCallbacks.propertyValueLength(buf.array(), 0));
+    }
+}
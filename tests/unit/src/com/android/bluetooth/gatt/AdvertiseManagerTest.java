@@ -0,0 +1,178 @@
+package com.android.bluetooth.gatt;
+
+import static org.mockito.Mockito.*;
+
+import android.bluetooth.BluetoothDevice;
+import android.bluetooth.le.AdvertisingSetParameters;
+import android.bluetooth.le.IAdvertisingSetCallback;
+import android.os.IBinder;
+
+import androidx.test.filters.SmallTest;
+import androidx.test.runner.AndroidJUnit4;
+
+import com.android.bluetooth.btservice.AdapterService;
+
+import org.junit.Assert;
+import org.junit.Before;
+import org.junit.Test;
+import org.junit.runner.RunWith;
+import org.mockito.Mock;
+import org.mockito.MockitoAnnotations;
+
+/**
+ * Test cases for {@link AdvertiseManager}.
+ */
+@SmallTest
+@RunWith(AndroidJUnit4.class)
+public class AdvertiseManagerTest {
+    private static final int REG_ID = -5;
+    private static final int VIRTUAL_ID = 0x80;
+    private static final int ADVERTISE_FAILED_TOO_MANY_ADVERTISERS = 2;
+
+    private AdvertiseManager mAdvertiseManager;
+    private AdvertisingSetParameters mParameters;
+
+    @Mock private GattService mGattService;
+    @Mock private AdapterService mAdapterService;
+    @Mock private IAdvertisingSetCallback mCallback;
+    @Mock private IBinder mBinder;
+
+    @Before
+    public void setUp() {
+        MockitoAnnotations.initMocks(this);
+        when(mCallback.asBinder()).thenReturn(mBinder);
+        mAdvertiseManager = spy(new AdvertiseManager(mGattService, mAdapterService));
+        mParameters = new AdvertisingSetParameters.Builder()
+                .setLegacyMode(false)
+                .setConnectable(false)
+                .setScannable(true)
+                .setIncludeTxPower(true)
+                .setPrimaryPhy(BluetoothDevice.PHY_LE_1M)
+                .setSecondaryPhy(BluetoothDevice.PHY_LE_2M)
+                .setInterval(AdvertisingSetParameters.INTERVAL_MEDIUM)
+                .setTxPowerLevel(AdvertisingSetParameters.TX_POWER_HIGH)
+                .build();
+    }
+
+    private void addPendingStart(boolean periodic) {
+        mAdvertiseManager.mAdvertisers.put(mBinder,
+                mAdvertiseManager.new AdvertiserInfo(REG_ID, null, mCallback));
+        mAdvertiseManager.mPendingStarts.put(REG_ID, new AdvertiseManager.PendingStart(
+                AdvertiseManager.packParameters(mParameters), new byte[0], new byte[0],
+                periodic));
+    }
+
+    @Test
+    public void testPackParameters() {
+        int[] packed = AdvertiseManager.packParameters(mParameters);
+        Assert.assertEquals(AdvertiseManager.PACKED_PARAM_COUNT, packed.length);
+        Assert.assertEquals(0, packed[AdvertiseManager.PACKED_PARAM_CONNECTABLE]);
+        Assert.assertEquals(1, packed[AdvertiseManager.PACKED_PARAM_SCANNABLE]);
+        Assert.assertEquals(0, packed[AdvertiseManager.PACKED_PARAM_LEGACY]);
+        Assert.assertEquals(0, packed[AdvertiseManager.PACKED_PARAM_ANONYMOUS]);
+        Assert.assertEquals(1, packed[AdvertiseManager.PACKED_PARAM_INCLUDE_TX_POWER]);
+        Assert.assertEquals(BluetoothDevice.PHY_LE_1M,
+                packed[AdvertiseManager.PACKED_PARAM_PRIMARY_PHY]);
+        Assert.assertEquals(BluetoothDevice.PHY_LE_2M,
+                packed[AdvertiseManager.PACKED_PARAM_SECONDARY_PHY]);
+        Assert.assertEquals(AdvertisingSetParameters.INTERVAL_MEDIUM,
+                packed[AdvertiseManager.PACKED_PARAM_INTERVAL]);
+        Assert.assertEquals(AdvertisingSetParameters.TX_POWER_HIGH,
+                packed[AdvertiseManager.PACKED_PARAM_TX_POWER_LEVEL]);
+    }
+
+    @Test
+    public void testVirtualSetWeight() {
+        Assert.assertEquals(1,
+                AdvertiseManager.virtualSetWeight(AdvertisingSetParameters.INTERVAL_HIGH));
+        Assert.assertEquals(4,
+                AdvertiseManager.virtualSetWeight(AdvertisingSetParameters.INTERVAL_MEDIUM));
+        Assert.assertEquals(10,
+                AdvertiseManager.virtualSetWeight(AdvertisingSetParameters.INTERVAL_LOW));
+        Assert.assertEquals(1, AdvertiseManager.virtualSetWeight(0));
+    }
+
+    @Test
+    public void testTooManyAdvertisers_startsVirtualSet() throws Exception {
+        addPendingStart(false);
+        doReturn(VIRTUAL_ID).when(mAdvertiseManager).startVirtualAdvertisingSet(any());
+
+        mAdvertiseManager.onAdvertisingSetStarted(REG_ID, 0, 0,
+                ADVERTISE_FAILED_TOO_MANY_ADVERTISERS);
+
+        verify(mCallback).onAdvertisingSetStarted(VIRTUAL_ID,
+                AdvertisingSetParameters.TX_POWER_HIGH, 0);
+        Assert.assertEquals(VIRTUAL_ID, (int) mAdvertiseManager.mAdvertisers.get(mBinder).id);
+        Assert.assertTrue(mAdvertiseManager.mPendingStarts.isEmpty());
+    }
+
+    @Test
+    public void testTooManyAdvertisers_virtualSetFails() throws Exception {
+        addPendingStart(false);
+        doReturn(-1).when(mAdvertiseManager).startVirtualAdvertisingSet(any());
+
+        mAdvertiseManager.onAdvertisingSetStarted(REG_ID, 0, 0,
+                ADVERTISE_FAILED_TOO_MANY_ADVERTISERS);
+
+        verify(mCallback).onAdvertisingSetStarted(0, 0, ADVERTISE_FAILED_TOO_MANY_ADVERTISERS);
+        Assert.assertFalse(mAdvertiseManager.mAdvertisers.containsKey(mBinder));
+    }
+
+    @Test
+    public void testTooManyAdvertisers_periodicNotMultiplexed() throws Exception {
+        addPendingStart(true);
+
+        mAdvertiseManager.onAdvertisingSetStarted(REG_ID, 0, 0,
+                ADVERTISE_FAILED_TOO_MANY_ADVERTISERS);
+
+        verify(mAdvertiseManager, never()).startVirtualAdvertisingSet(any());
+        verify(mCallback).onAdvertisingSetStarted(0, 0, ADVERTISE_FAILED_TOO_MANY_ADVERTISERS);
+    }
+
+    private void addRunningSet(int advertiserId) {
+        IBinder binder = mock(IBinder.class);
+        mAdvertiseManager.mAdvertisers.put(binder,
+                mAdvertiseManager.new AdvertiserInfo(advertiserId, null, mCallback));
+    }
+
+    @Test
+    public void testVirtualSetReservation_reservesLastFreeSet() {
+        when(mAdapterService.getNumOfAdvertisementInstancesSupported()).thenReturn(3);
+        doNothing().when(mAdvertiseManager).reserveVirtualAdvertisingSet(anyBoolean());
+
+        addRunningSet(0);
+        mAdvertiseManager.updateVirtualSetReservation();
+        verify(mAdvertiseManager, never()).reserveVirtualAdvertisingSet(anyBoolean());
+
+        addRunningSet(1);
+        mAdvertiseManager.updateVirtualSetReservation();
+        mAdvertiseManager.updateVirtualSetReservation();
+        verify(mAdvertiseManager, times(1)).reserveVirtualAdvertisingSet(true);
+    }
+
+    @Test
+    public void testVirtualSetReservation_keptWhileVirtualSetsRun() {
+        when(mAdapterService.getNumOfAdvertisementInstancesSupported()).thenReturn(3);
+        doNothing().when(mAdvertiseManager).reserveVirtualAdvertisingSet(anyBoolean());
+        addRunningSet(0);
+        addRunningSet(1);
+        mAdvertiseManager.updateVirtualSetReservation();
+
+        mAdvertiseManager.mAdvertisers.clear();
+        addRunningSet(VIRTUAL_ID);
+        mAdvertiseManager.updateVirtualSetReservation();
+        verify(mAdvertiseManager, never()).reserveVirtualAdvertisingSet(false);
+
+        mAdvertiseManager.mAdvertisers.clear();
+        mAdvertiseManager.updateVirtualSetReservation();
+        verify(mAdvertiseManager).reserveVirtualAdvertisingSet(false);
+    }
+
+    @Test
+    public void testVirtualSetReservation_neverTakesTheOnlySet() {
+        when(mAdapterService.getNumOfAdvertisementInstancesSupported()).thenReturn(1);
+        addRunningSet(0);
+        mAdvertiseManager.updateVirtualSetReservation();
+        verify(mAdvertiseManager, never()).reserveVirtualAdvertisingSet(anyBoolean());
+    }
+}
@@ -23,6 +23,9 @@ import org.junit.runner.RunWith;
 import org.mockito.Mock;
 import org.mockito.MockitoAnnotations;
 
+import java.util.Set;
+import java.util.UUID;
+
 /**
  * Test cases for {@link GattService}.
  */
@@ -90,4 +93,14 @@ public class GattServiceTest {
         Assert.assertEquals(99700000000L, timestampNanos);
     }
 
+    @Test
+    public void testParseUuidList() {
+        Set<UUID> uuids = GattService.parseUuidList(" 00002A37-0000-1000-8000-00805F9B34FB,"
+                + "not-a-uuid,,00002A19-0000-1000-8000-00805F9B34FB");
+        Assert.assertEquals(2, uuids.size());
+        Assert.assertTrue(uuids.contains(UUID.fromString("00002A37-0000-1000-8000-00805F9B34FB")));
+        Assert.assertTrue(uuids.contains(UUID.fromString("00002A19-0000-1000-8000-00805F9B34FB")));
+        Assert.assertTrue(GattService.parseUuidList("").isEmpty());
+    }
+
 }